@@ -27,19 +27,94 @@
 #include "main.h"
 
 /* USER CODE BEGIN Includes */
-
+#include "tim.h"
 /* USER CODE END Includes */
 
 extern ADC_HandleTypeDef hadc;
 
 /* USER CODE BEGIN Private defines */
+// Conversions of one scan, in channel order
+#define ADC_SCAN_CHANNELS			4
+#define ADC_RESULT_CH1				0
+#define ADC_RESULT_CH9				1
+#define ADC_RESULT_TEMPERATURE		2
+#define ADC_RESULT_VREFINT			3
+// Scans summed into one result, 16 scans of 12 bits give a 16-bit result with 2 extra bits of resolution
+#define ADC_OVERSAMPLING			16
+// Drift since the last calibration that triggers a new one, in result counts (about 5 degC and 0.5% VDDA)
+#define ADC_DRIFT_TEMPERATURE		400
+#define ADC_DRIFT_VREFINT			128
+// Factory calibration values, 12-bit conversions at VDDA = 3.3 V
+#define ADC_VREFINT_CAL				(* (uint16_t*) 0x1FFFF7BA)
+#define ADC_TS_CAL1					(* (uint16_t*) 0x1FFFF7B8)	// Temperature sensor at 30 degC
+#define ADC_TS_CAL2					(* (uint16_t*) 0x1FFFF7C2)	// Temperature sensor at 110 degC
+#define ADC_TS_CAL_SPAN				80							// degC between TS_CAL1 and TS_CAL2
+// Light sensor compensation, enabled by the bits of compensationControl in memory bank 189
+#define ADC_COMPENSATE_SUPPLY		(1 << 0)	// Scale the results to VDDA = 3.3 V with VREFINT
+#define ADC_COMPENSATE_TEMPERATURE	(1 << 1)	// Remove the dark level drift from 30 degC
+// The scans are held while the DALI bus is busy and for ADC_BUS_SETTLE after its last edge.
+// DALI_US comes from dali_timing.h, included after dali.h where it is used
+// A hold longer than ADC_HOLD_MAX ms is released and the next ADC_HOLD_RUN ms of scans are not held again
+#define ADC_BUS_SETTLE				DALI_US(1000)
+#define ADC_HOLD_MAX				25
+#define ADC_HOLD_RUN				ADC_OVERSAMPLING
+// Scope capture of one channel, raw 12-bit conversions every period*10 us
+#define ADC_SCOPE_SAMPLES			512
+#define ADC_SCOPE_MIN_PERIOD		3		// A conversion takes about 19 us
+#define ADC_SCOPE_TICKS				10		// TIM15 ticks of 1 us per period unit
+// Scope status, same values as the calibration status
+#define ADC_SCOPE_DONE				0x00
+#define ADC_SCOPE_BUSY				0x01
+#define ADC_SCOPE_ERROR				0x02
+#define ADC_SCOPE_IDLE				0xFF
 
+extern volatile uint16_t adc_result[ADC_SCAN_CHANNELS];
+extern volatile uint8_t adc_result_ready;
+// Set by every result, cleared by adc_resume
+extern volatile uint8_t adc_sampled;
+extern volatile uint8_t adc_error;
+// Set with adc_error when results are lost. The calibration capture clears it when it starts, adc_error stays set
+extern volatile uint8_t adc_sample_error;
+// Set when a conversion of the watched channel left the analog watchdog window
+extern volatile uint8_t adc_window_flag;
+// Temperature of the last result in 1/16 degC above 30 degC
+extern int32_t adc_temperature_q4;
+extern uint16_t adc_scope_buffer[ADC_SCOPE_SAMPLES];
+extern volatile uint8_t adc_scope_state;
+// Set when the scope buffer is full and the scans are waiting for adc_scope_finish
+extern volatile uint8_t adc_scope_flag;
 /* USER CODE END Private defines */
 
 void MX_ADC_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+// Calibrate the ADC and start the TIM15 triggered scans into the DMA buffer
+void adc_start(void);
+// Stop the scans for STOP mode and start them again after it, or after a scope capture. No calibration
+void adc_suspend(void);
+void adc_resume(void);
+// Calibrate again when temperature or supply moved away from the last calibration. This is the only
+// recalibration after adc_start at boot, the scans restart with adc_resume otherwise
+void adc_check_drift(void);
+// Select the channel watched by the analog watchdog, given by its ADC_RESULT_ index. Call before adc_start
+void adc_watchdog_init(uint8_t result_index);
+// Wake up once when a 12-bit conversion of the watched channel goes below low or above high
+void adc_watchdog_arm(uint16_t low, uint16_t high);
+void adc_watchdog_disarm(void);
+// Select the compensation bits and the dark level drift in result counts per degC
+void adc_compensation_configure(uint8_t control, int8_t temperatureCoeff);
+// Work out the supply gain and the dark level drift of the latest results, once per result
+void adc_compensation_update(void);
+// Compensate a light sensor result, and map a window of compensated 12-bit counts back to conversions
+uint16_t adc_compensate(uint16_t sample);
+void adc_compensate_window(uint16_t *low, uint16_t *high);
+// Hold the scans on a bus edge, called from the DALI RX edge interrupt.
+// A 1 ms timer runs while they are held and releases them once the bus is quiet or the hold is too long
+void adc_bus_hold(void);
+// Pause the scans and capture ADC_SCOPE_SAMPLES conversions of one channel, given by its ADC_RESULT_ index
+void adc_scope_start(uint8_t result_index, uint8_t period);
+// Go back to the scans once adc_scope_flag is set
+void adc_scope_finish(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
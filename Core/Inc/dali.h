@@ -101,13 +101,26 @@ void DALIConfigureMode(uint8_t mode);
 // This needs to be called from the ISR unconditionally. It checks and clears
 // the Tick timer, Te timer and External interrupt flags.
 void DALITimerIntHandler(void);
-void DALIRxIntHandler(void);
+
+// Timestamp a bus edge, called from the RX EXTI ISR at the highest priority. The TIM2
+// interrupt is pended to decode it
+void DALIRxEdgeCapture(void);
+
+// Returns 1 when captured edges wait to be decoded
+uint8_t DALIRxEdgePending(void);
+
+// Decode the captured edges in order, called from the TIM2 ISR before the timer itself
+void DALIRxEdgeDecode(void);
 
 // Transmit command on the DALI bus. The machine will also wait for any reply
-// after the transmission. The function returns 0 when successful and 1 to signal
-// an error (machine busy).
+// after the transmission. The frame is queued and picked up from the TIM2 ISR, any
+// priority below it may send. The function returns 0 when successful and 1 to signal
+// an error (queue full).
 uint8_t DALISendData(DALITxData_t data);
 
+// Start or schedule the frames queued by DALISendData, called from the TIM2 ISR
+void DALIServiceTxQueue(void);
+
 // Returns true if there's any data available in the input data buffer
 uint8_t DALIDataAvailable(void);
 
@@ -117,11 +130,30 @@ uint8_t DALIDataAvailable(void);
 // functions this be called first.
 DALIRxData_t DALIReceiveData(void);
 
+// Time base value at which the next frame to be read was queued
+uint32_t DALIReceiveTime(void);
+
 // Function that returns the flags associated to the data being read. These
 // give the status of this data transaction. The user must first call
 // DALIReceiveDataForward.
 uint8_t DALIReceiveDataFlags(void);
 
+// Returns 1 when no frame is on the bus or expected (idle, or waiting to send) and the bus
+// has not moved for at least settle TIM2 counts. Used to keep ADC conversions away from bus edges
+uint8_t DALIBusQuiet(uint32_t settle);
+
+// Returns 1 when every queued frame has been sent and this device is not transmitting or about to
+uint8_t DALITxDone(void);
+
+// Returns 1 when the core may enter STOP: nothing to send or to hand to the application, and the bus
+// idle for longer than any timing the machine looks at, so that stopping the time base changes nothing
+uint8_t DALIStopAllowed(void);
+
+// Called with interrupts disabled as soon as the core leaves STOP. When the RX edge woke it,
+// TIM2 is set to the time it was stopped so that the first half of the start bit is timed right
+// and 1 is returned
+uint8_t DALIStopWake(void);
+
 //Check if cable is connected. This function is run in SysTick ISR. Cable is considered
 //disconnected after 20ms DALI line is low
 void DALICheckCable(void);
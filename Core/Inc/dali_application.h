@@ -9,6 +9,8 @@
 #ifndef INC_DALI_APPLICATION_H_
 #define INC_DALI_APPLICATION_H_
 #include "dali_memory.h"
+#include "soft_timer.h"
+#include "fixed_ratio.h"
 
 #define SENSOR_FAILURE				0x01
 #define MANUFACTURER_ERROR_1		0x10
@@ -27,6 +29,17 @@
 #define APP_CONTROLLER_ERROR		0x10
 #define POWER_CYCLE_SEEN			0x20
 #define RESET_STATE					0x40
+// Size of the instance table. numberOfInstances tells how many of the entries are
+// implemented on this device, at most 32.
+#define MAX_INSTANCES				6
+// Instance types implemented on this board, listed by instance index. Used as ROM default.
+#define INSTANCE_TYPES				{LIGHT_SENSOR, PUSH_BUTTON, OCCUPANCY_SENSOR, ABSOLUTE_INPUT, LIGHT_SENSOR, GENERIC_INSTANCE}
+// Cortex-M0 has no hardware divider. The hysteresis band hysteresis*inputValue/100 is the
+// fixed_ratio of HYSTERESIS_MUL(hysteresis), bit-exact and in 32 bits for any 16-bit inputValue
+#define HYSTERESIS_SHIFT			16
+#define HYSTERESIS_MUL(h)			fixed_ratio_mul((h), 100, HYSTERESIS_SHIFT)
+// The light sensor conversion 1000*adcVal/d is the fixed_ratio of conversionMul for adcVal up to 2^16
+#define CONVERSION_SHIFT			21
 //Device variables in NVM
 #define deviceGroups_NVM						(* (uint32_t*) (MEMORY_NVM_VAR_ADDR + 0))	// each bit represents 1 device group
 #define randomAddress_NVM						(* (uint32_t*) (MEMORY_NVM_VAR_ADDR + 4))
@@ -34,7 +47,7 @@
 #define operatingMode_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 10))
 #define applicationActive_NVM					(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 12))
 #define powerCycleNotification_NVM				(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 14))
-#define eventPriority_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 16))	// range from 2 to 5
+// Offset 16 held the event priority before it became an instance variable
 
 // Device variables in ROM
 #define numberOfInstances_NVM					(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 0))
@@ -43,24 +56,32 @@
 #define versionNumber_NVM						(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 6))	// 2.1
 #define extendedVersionNumber_NVM				(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 8))	// 2.0
 
-//Instance variables in NVM
-#define instanceGroup0_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 18))
-#define instanceGroup1_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 20))
-#define instanceGroup2_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 22))
-#define instanceActive_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 24))
-#define eventFilter_NVM							(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 26))
-#define	eventScheme_NVM							(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 28))
+//Instance variables in NVM, one block per instance. Instance 0 keeps the addresses of the single instance layout
+#define INSTANCE_NVM_SIZE						22
+#define INSTANCE_NVM_ADDR(i)					(MEMORY_NVM_VAR_ADDR + 18 + (i)*INSTANCE_NVM_SIZE)
+#define instanceGroup0_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 0))
+#define instanceGroup1_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 2))
+#define instanceGroup2_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 4))
+#define instanceActive_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 6))
+#define eventFilter_NVM(i)						(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 8))
+#define	eventScheme_NVM(i)						(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 10))
 
-// Instance variables in ROM
-#define instanceType_NVM						(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 10))
-#define	resolution_NVM							(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 12))	// should be 10
-#define	instanceNumber_NVM						(* (uint16_t*) (MEMORY_ROM_VAR_ADDR + 14))
+// Instance variables in ROM, one block per instance
+#define INSTANCE_ROM_SIZE						6
+#define INSTANCE_ROM_ADDR(i)					(MEMORY_ROM_VAR_ADDR + 10 + (i)*INSTANCE_ROM_SIZE)
+#define instanceType_NVM(i)						(* (uint16_t*) (INSTANCE_ROM_ADDR(i) + 0))
+#define	resolution_NVM(i)						(* (uint16_t*) (INSTANCE_ROM_ADDR(i) + 2))	// should be 10
+#define	instanceNumber_NVM(i)					(* (uint16_t*) (INSTANCE_ROM_ADDR(i) + 4))
 
 // Input device-only variables
-#define	tReport_NVM								(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 30))
-#define tDeadtime_NVM							(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 32))
-#define hysteresisMin_NVM						(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 34))
-#define hysteresis_NVM							(* (uint16_t*) (MEMORY_NVM_VAR_ADDR + 36))
+#define	tReport_NVM(i)							(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 12))
+#define tDeadtime_NVM(i)						(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 14))
+#define hysteresisMin_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 16))
+#define hysteresis_NVM(i)						(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 18))
+#define eventPriority_NVM(i)					(* (uint16_t*) (INSTANCE_NVM_ADDR(i) + 20))	// range from 2 to 5
+
+_Static_assert(MAX_INSTANCES <= 32, "DALI-2 addresses at most 32 instances");
+_Static_assert(18 + MAX_INSTANCES*INSTANCE_NVM_SIZE <= 0x400, "Instance variables do not fit in the NVM page");
 
 typedef struct DALICmdFrame
 {
@@ -91,6 +112,42 @@ enum
 	TRUE
 };
 
+enum instance_type
+{
+	GENERIC_INSTANCE		= 0,
+	PUSH_BUTTON				= 1,
+	ABSOLUTE_INPUT			= 2,
+	OCCUPANCY_SENSOR		= 3,
+	LIGHT_SENSOR			= 4
+};
+
+// Instance variables, one entry per instance
+typedef struct
+{
+	uint16_t			inputValue[MAX_INSTANCES];	// maximum = (2^(N*8)-1) where N = round(resolution/8)
+	uint8_t				instanceError[MAX_INSTANCES];
+	uint8_t				instanceGroup0[MAX_INSTANCES];
+	uint8_t				instanceGroup1[MAX_INSTANCES];
+	uint8_t				instanceGroup2[MAX_INSTANCES];
+	uint8_t				instanceActive[MAX_INSTANCES];
+	uint8_t				instanceType[MAX_INSTANCES];
+	uint8_t				instanceNumber[MAX_INSTANCES];
+	uint8_t				resolution[MAX_INSTANCES];	// should be 10
+	uint32_t			eventFilter[MAX_INSTANCES];
+	uint8_t				eventScheme[MAX_INSTANCES];
+	uint8_t				eventPriority[MAX_INSTANCES];	// range from 2 to 5
+	// Input device only variables
+	uint8_t				tReport[MAX_INSTANCES];		// s
+	uint8_t				tDeadtime[MAX_INSTANCES];	// 50 ms
+	uint8_t				hysteresisMin[MAX_INSTANCES];
+	uint8_t				hysteresis[MAX_INSTANCES];
+	uint32_t			hysteresisBandHigh[MAX_INSTANCES];
+	uint32_t			hysteresisBandLow[MAX_INSTANCES];
+	uint32_t			hysteresisMul[MAX_INSTANCES];	// HYSTERESIS_MUL(hysteresis)
+	soft_timer_t		reportTimer[MAX_INSTANCES];	// tReport
+	soft_timer_t		deadTimer[MAX_INSTANCES];	// tDeadtime
+} DALIInstances_t;
+
 enum opcode_app_controller
 {
 	IDENTIFY_DEVICE 							= 0x00,
@@ -218,26 +275,31 @@ extern uint8_t		deviceCapabilities;
 extern uint8_t		deviceStatus;
 
 // Instance variables
-extern uint16_t		inputValue;
-extern uint8_t		instanceError;
+extern uint16_t			numberOfInstances;
+extern DALIInstances_t	instances;
+// One bit per instance whose input changed or whose timers expired since events were last evaluated
+extern volatile uint32_t instancePending;
 
 // Input device only Variables
 extern uint8_t		instanceErrorByte;
-extern uint32_t		hysteresisBand;
-extern uint32_t		hysteresisBandHigh;
-extern uint32_t		hysteresisBandLow;
-extern uint16_t 	id_time;
 
-extern volatile uint8_t	quiescent_time;
-extern volatile uint8_t	initialise_time;
-extern volatile uint16_t report_time;
-extern volatile uint16_t dead_time;
-extern volatile uint16_t powerNoti_time;
 extern volatile uint8_t powerNoti_flag;
+// Set when a command changed memory bank 189 or 190, the main loop then calls DALI_Update_Conversion
+extern volatile uint8_t conversionPending;
 // Initialize DALI application
 void DALI_AppInit();
 // Process Rx data
 void DALI_ProcessRxData();
+/*
+ * Process all received frames, called from PendSV which the DALI driver pends when it queues a frame.
+ * PendSV has the lowest priority, the bus interrupts and SysTick keep running while a command is handled.
+ * The main loop takes the lock only while it reads or changes instance and device state the commands
+ * also use, frames that arrive meanwhile are processed when the lock is released. Its flash writes
+ * are done here too, and the conversion and filter state changed by commands is updated by the main loop
+ * */
+void DALI_Dispatch(void);
+void DALI_Dispatch_Lock(void);
+void DALI_Dispatch_Unlock(void);
 /*
  * Generate Event message
  * In this case, the input device only generate INPUT NOTIFICATION event to report illumination level
@@ -245,14 +307,35 @@ void DALI_ProcessRxData();
  * or after a tReport timeout
  * There are other conditions for event generation such as eventFilter, quiescentMode, tDeadtime,
  * instanceActive, instanceError, applicationActive
+ * Only the instances marked in instancePending are evaluated
  * */
 void DALI_SendEvent();
+// Build an event frame for an instance following its event scheme
+uint32_t DALI_Build_EventFrame(uint8_t instance, uint16_t eventInfo);
+// Store a new input value of an instance and mark it for event evaluation if it changed
+void DALI_Instance_SetValue(uint8_t instance, uint16_t value);
+// Queue an event of an event driven instance if its event filter lets it through. ISR safe
+void DALI_Instance_RaiseEvent(uint8_t instance, uint16_t eventInfo, uint32_t filter);
+// Mark all instances for event evaluation, e.g. when quiescent mode ends
+void DALI_Instance_MarkAll(void);
+// Restart the tReport and tDeadtime timers of an instance after it reported, their expiry marks it for event evaluation
+void DALI_Instance_RestartTimers(uint8_t instance);
+// Callback of the tReport timers, for drivers that restart only the report timer
+void DALI_Instance_ReportExpired(soft_timer_t *timer);
+// Check if the instance byte of a command addresses an instance (broadcast, number, type or group)
+uint8_t DALI_Instance_Match(uint8_t instance, uint8_t instance_byte);
 // Reset all variables
 void DALI_Reset_Variable();
 // Reset memory bank
 void DALI_Reset_Memory();
 // Save variables to NVM
 void DALI_Save_Variable();
-// Set inputValue
-void DALI_Set_inputValue(uint32_t adcVal);
+// Set inputValue of a light sensor instance from a raw ADC reading
+void DALI_Set_inputValue(uint8_t instance, uint32_t adcVal);
+// Map the hysteresis band of a light sensor instance back to 12-bit ADC counts for the ADC window.
+// The window is never wider than the band. Returns FALSE when there is no band yet or a linearisation table is used
+uint8_t DALI_Get_adcWindow(uint8_t instance, uint16_t *low, uint16_t *high);
+// Precompute the multiplier used by DALI_Set_inputValue and reload the light sensor filter,
+// called when memory bank 189 changes
+void DALI_Update_Conversion(void);
 #endif /* INC_DALI_APPLICATION_H_ */
@@ -0,0 +1,51 @@
+/*
+ * dali_calibration.h
+ * This file implements the in-field calibration of the light sensors. A write to
+ * calibrateDark or calibrateFullScale in memory bank 189 starts a capture, the
+ * result is stored in the calibration offset or scale of each light sensor
+ */
+
+#ifndef INC_DALI_CALIBRATION_H_
+#define INC_DALI_CALIBRATION_H_
+
+#include "stdint.h"
+#include "dali_input.h"
+
+// Oversampled results averaged by one calibration, 16 results of 16 conversions
+#define CALIBRATION_SAMPLES			16
+#define CALIBRATION_SAMPLES_SHIFT	4
+// A full scale capture at or above this 12-bit count is taken as saturated
+#define CALIBRATION_SATURATION		4080
+
+typedef enum
+{
+	CALIBRATION_WAIT,
+	CALIBRATION_DARK,
+	CALIBRATION_FULL_SCALE
+} calibration_state_t;
+
+typedef struct
+{
+	calibration_state_t	state;
+	uint8_t				count;
+	uint8_t				sensors;	// Light sensors captured, fixed at the start of the capture
+	uint32_t			sum[LIGHT_SENSORS];	// Sum of the captured oversampled results of each sensor
+	volatile uint8_t	commit;		// Result waiting for DALI_Calibration_Commit
+	uint8_t				address[LIGHT_SENSORS];	// Bank 189 bytes of the result and their values
+	uint8_t				value[LIGHT_SENSORS];
+} DALICalibration_t;
+
+/**********************Public function definitions*****************************/
+
+// Take the new oversampled results of the first 'sensors' light sensors. Starts a requested
+// calibration, adds the results to a running one and commits the outcome of all sensors to
+// memory bank 189 in one flash write when it is complete.
+// Called from the main loop, never blocks. The result is written by DALI_Calibration_Commit.
+// error flags lost results, it is cleared when a capture starts and fails the capture when set
+void DALI_Calibration_Update(uint16_t const *samples, uint8_t sensors, volatile uint8_t *error);
+
+// Write a complete calibration to memory bank 189 in one flash write. Called from the dispatcher,
+// which serialises it with the flash writes of the commands
+void DALI_Calibration_Commit(void);
+
+#endif /* INC_DALI_CALIBRATION_H_ */
@@ -0,0 +1,55 @@
+/*
+ * dali_filter.h
+ * This file implements the filter stage between the light sensor acquisition
+ * and the event evaluation. The filter type and its coefficients are stored in
+ * memory bank 189
+ */
+
+#ifndef INC_DALI_FILTER_H_
+#define INC_DALI_FILTER_H_
+
+#include "stdint.h"
+
+// Filter types, selected by filterType in memory bank 189
+enum filter_type
+{
+	FILTER_NONE				= 0,
+	FILTER_MOVING_AVERAGE	= 1,	// Mean of the last filterLength samples, rounded down to a power of 2
+	FILTER_IIR				= 2,	// Single pole, y += (x - y)/2^filterShift
+	FILTER_MEDIAN			= 3,	// Median of the last filterLength samples
+	FILTER_MEDIAN_IIR		= 4		// Median to drop spikes, then IIR to smooth
+};
+// Longest window for the moving average and the median, in samples
+#define FILTER_MAX_LENGTH		8
+// Largest IIR shift, the time constant is about 2^filterShift samples
+#define FILTER_MAX_SHIFT		8
+// Fraction bits kept by the IIR state so that small steps are not lost
+#define FILTER_IIR_FRACTION		8
+
+typedef struct
+{
+	uint8_t				type;
+	uint8_t				length;
+	uint8_t				shift;
+	uint8_t				meanShift;		// The moving average window is 2^meanShift samples, its mean is a shift
+	uint16_t			window[FILTER_MAX_LENGTH];
+	uint8_t				index;			// Next window entry to be replaced
+	uint8_t				count;			// Valid samples in the window
+	uint32_t			sum;			// Sum of the window
+	uint32_t			iir;			// IIR output with FILTER_IIR_FRACTION fraction bits
+	uint16_t			output;
+} DALIFilter_t;
+
+// Filter of each light sensor channel, fed with every oversampled result
+extern DALIFilter_t illuminanceFilter[];
+
+/**********************Public function definitions*****************************/
+
+// Load the filter type and coefficients from memory bank 189 and restart the filter.
+// Values out of range are clamped, an unknown type disables the filter
+void DALI_Filter_Configure(DALIFilter_t *filter);
+
+// Add a 16-bit oversampled sample and return the filtered value
+uint16_t DALI_Filter_Update(DALIFilter_t *filter, uint16_t sample);
+
+#endif /* INC_DALI_FILTER_H_ */
@@ -0,0 +1,67 @@
+/*
+ * dali_flicker.h
+ * This file implements the flicker analysis of the light sensor. A scope capture
+ * of the light sensor channel is taken periodically and reduced to percent flicker,
+ * flicker index and dominant frequency with Goertzel bins
+ */
+
+#ifndef INC_DALI_FLICKER_H_
+#define INC_DALI_FLICKER_H_
+
+#include "stdint.h"
+#include "soft_timer.h"
+
+// Capture of ADC_SCOPE_SAMPLES conversions every FLICKER_SAMPLE_PERIOD*10 us, 2 kHz for 256 ms
+#define FLICKER_SAMPLE_PERIOD		50
+#define FLICKER_SAMPLE_RATE			2000
+// Time in ms between two analyses
+#define FLICKER_T_PERIOD			10000
+// Bins searched for the dominant frequency, from about 40 Hz up to below FLICKER_SAMPLE_RATE/2
+#define FLICKER_BIN_MIN				10
+#define FLICKER_BIN_MAX				255
+// Goertzel inputs are scaled to +/-2^FLICKER_INPUT_BITS around the mean so that the
+// state stays in 32 bits with FLICKER_COEFF_FRACTION coefficient fraction bits
+#define FLICKER_INPUT_BITS			6
+#define FLICKER_COEFF_FRACTION		14
+// 2cos(2*pi/ADC_SCOPE_SAMPLES) with 29 fraction bits, the coefficient of bin k is stepped from it
+#define FLICKER_COS_STEP			1073660973
+#define FLICKER_COS_FRACTION		29
+
+typedef enum
+{
+	FLICKER_WAIT,
+	FLICKER_CAPTURE,
+	FLICKER_STATISTICS,
+	FLICKER_BINS
+} flicker_state_t;
+
+typedef struct
+{
+	flicker_state_t		state;
+	soft_timer_t		waitTimer;		// Time to the next capture
+	int32_t				mean;			// 12-bit counts with the dark level removed
+	uint8_t				shift;			// Input scaling of the Goertzel bins
+	uint16_t			bin;			// Next bin to evaluate
+	int32_t				cosPrevious;	// 2cos of the bin before, FLICKER_COS_FRACTION fraction bits
+	int32_t				cosCurrent;		// 2cos of the next bin
+	uint64_t			peakPower;
+	uint16_t			peakBin;
+	uint16_t			percent;		// Percent flicker in 0.1 %
+	uint16_t			index;			// Flicker index in 0.001
+	uint16_t			frequency;		// Dominant frequency in Hz, 0 without flicker
+} DALIFlicker_t;
+
+extern DALIFlicker_t flicker;
+
+/**********************Public function definitions*****************************/
+
+// Start the wait for the first capture
+void DALI_Flicker_Init(void);
+
+// Advance the analysis by one step, called from the main loop. A step is one pass over
+// the capture or one Goertzel bin, which keeps it well below a DALI backward frame delay.
+// result_index is the ADC_RESULT_ index of the light sensor channel.
+// Returns 1 while steps are left, the main loop does not sleep until the analysis is done
+uint8_t DALI_Flicker_Update(uint8_t result_index);
+
+#endif /* INC_DALI_FLICKER_H_ */
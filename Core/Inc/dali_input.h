@@ -0,0 +1,158 @@
+/*
+ * dali_input.h
+ * This file implements the instance type drivers of DALI input devices.
+ * The drivers turn pin edges and samples into instance values and events
+ * for the application layer
+ */
+
+#ifndef INC_DALI_INPUT_H_
+#define INC_DALI_INPUT_H_
+
+#include "dali_application.h"
+
+// Instance index of each driver, must match INSTANCE_TYPES
+#define LIGHT_SENSOR_INSTANCE			0
+#define BUTTON_INSTANCE					1
+#define OCCUPANCY_INSTANCE				2
+#define ABSOLUTE_INPUT_INSTANCE			3
+#define SECOND_LIGHT_SENSOR_INSTANCE	4
+#define FLICKER_INSTANCE				5
+
+/********************** Light sensor (IEC 62386-304) **************************/
+// Light sensors converted in the same ADC scan. Each one has its own calibration in memory bank 189
+#define LIGHT_SENSORS					2
+#define LIGHT_SENSOR(instance)			(((instance) == SECOND_LIGHT_SENSOR_INSTANCE) ? 1 : 0)
+
+/********************** Push button (IEC 62386-301) ***************************/
+// Button is active low on BUTTON_Pin
+#define BUTTON_ACTIVE_LEVEL				0
+// Timing in ms
+#define BUTTON_T_DEBOUNCE				20		// Edges are ignored for this time after an accepted edge
+#define BUTTON_T_SHORT					500		// Held longer than this is a long press
+#define BUTTON_T_DOUBLE					300		// Second press within this time after a short press is a double press, 0 to disable
+#define BUTTON_T_REPEAT					160		// Long press repeat period
+#define BUTTON_T_STUCK					20000	// Held longer than this is reported as stuck
+
+// Event information
+#define BUTTON_RELEASED_EVENT			0x00
+#define BUTTON_PRESSED_EVENT			0x01
+#define BUTTON_SHORT_PRESS_EVENT		0x02
+#define BUTTON_DOUBLE_PRESS_EVENT		0x05
+#define BUTTON_LONG_PRESS_START_EVENT	0x09
+#define BUTTON_LONG_PRESS_REPEAT_EVENT	0x0B
+#define BUTTON_LONG_PRESS_STOP_EVENT	0x0C
+#define BUTTON_FREE_EVENT				0x0E
+#define BUTTON_STUCK_EVENT				0x0F
+
+// Event filter bits
+#define BUTTON_RELEASED_FILTER			(1 << 0)
+#define BUTTON_PRESSED_FILTER			(1 << 1)
+#define BUTTON_SHORT_PRESS_FILTER		(1 << 2)
+#define BUTTON_DOUBLE_PRESS_FILTER		(1 << 3)
+#define BUTTON_LONG_PRESS_START_FILTER	(1 << 4)
+#define BUTTON_LONG_PRESS_REPEAT_FILTER	(1 << 5)
+#define BUTTON_LONG_PRESS_STOP_FILTER	(1 << 6)
+#define BUTTON_STUCK_FREE_FILTER		(1 << 7)
+#define BUTTON_EVENT_FILTER_DEFAULT		(BUTTON_SHORT_PRESS_FILTER | BUTTON_DOUBLE_PRESS_FILTER | BUTTON_LONG_PRESS_START_FILTER \
+										| BUTTON_LONG_PRESS_REPEAT_FILTER | BUTTON_LONG_PRESS_STOP_FILTER)
+
+/********************** Occupancy sensor (IEC 62386-303) **********************/
+// PIR output is active high on PIR_Pin while there is movement
+#define PIR_ACTIVE_LEVEL				1
+// Time in ms the area stays occupied after the last movement
+#define OCCUPANCY_T_HOLD				(15*60*1000UL)
+// Occupancy events go out ahead of periodic reports
+#define OCCUPANCY_EVENT_PRIORITY		2
+
+// Input value
+#define OCCUPANCY_VACANT_VALUE			0x00
+#define OCCUPANCY_OCCUPIED_VALUE		0xAA
+#define OCCUPANCY_MOVEMENT_VALUE		0xFF
+
+// Event information bits
+#define OCCUPANCY_MOVEMENT_BIT			(1 << 0)	// 0 for no movement
+#define OCCUPANCY_OCCUPIED_BIT			(1 << 1)	// 0 for vacant
+#define OCCUPANCY_REPEAT_BIT			(1 << 2)	// Repeated state report after tReport
+
+// Event filter bits
+#define OCCUPANCY_OCCUPIED_FILTER		(1 << 0)
+#define OCCUPANCY_VACANT_FILTER			(1 << 1)
+#define OCCUPANCY_REPEAT_FILTER			(1 << 2)
+#define OCCUPANCY_MOVEMENT_FILTER		(1 << 3)
+#define OCCUPANCY_NO_MOVEMENT_FILTER	(1 << 4)
+#define OCCUPANCY_EVENT_FILTER_DEFAULT	(OCCUPANCY_OCCUPIED_FILTER | OCCUPANCY_VACANT_FILTER | OCCUPANCY_REPEAT_FILTER)
+
+/********************** Absolute input (IEC 62386-302) ************************/
+// Sampling period in ms while the position moves and once it has settled
+#define ABSOLUTE_T_FAST					20
+#define ABSOLUTE_T_IDLE					500
+// The position has settled after this many samples moved less than the settle delta (16-bit oversampled counts)
+#define ABSOLUTE_SETTLE_DELTA			256
+#define ABSOLUTE_SETTLE_COUNT			10
+
+typedef enum
+{
+	BUTTON_RELEASED,
+	BUTTON_PRESSED,
+	BUTTON_LONG_PRESS,
+	BUTTON_STUCK
+} button_state_t;
+
+typedef struct
+{
+	button_state_t		state;
+	uint8_t				doubleWait;		// Short press released, waiting for a second press
+	uint8_t				doublePress;	// This press is the second one of a double press
+	soft_timer_t		debounceTimer;
+	soft_timer_t		deadlineTimer;	// Next timed transition, stopped when none is due
+	uint16_t			heldTime;		// ms
+} DALIButton_t;
+
+typedef struct
+{
+	uint8_t				occupied;
+	uint8_t				movement;
+	soft_timer_t		holdTimer;
+} DALIOccupancy_t;
+
+typedef struct
+{
+	uint16_t			lastSample;		// 16-bit oversampled
+	uint8_t				settleCount;
+	uint16_t			period;			// ms
+	soft_timer_t		sampleTimer;
+} DALIAbsoluteInput_t;
+
+// Set when the absolute input channel is due to be sampled
+extern volatile uint8_t absolute_flag;
+
+/**********************Public function definitions*****************************/
+
+// Initialise the driver state from the current pin levels
+void DALI_Input_Init(void);
+
+// Handle an edge of the button pin, called from the EXTI ISR
+void DALI_Input_ButtonIntHandler(void);
+
+// Handle an edge of the PIR pin, called from the EXTI ISR
+void DALI_Input_OccupancyIntHandler(void);
+
+// Take a 16-bit oversampled result of the absolute input and adapt the sampling period to its movement
+void DALI_Input_AbsoluteSample(uint32_t adcVal);
+
+// Move the hysteresis band of a value instance to inputValue when it left the band.
+// Returns TRUE when it did, the value is then reported
+uint8_t DALI_Input_Hysteresis(uint8_t instance, uint16_t inputValue);
+
+// Instance types that send the events raised by their driver instead of value reports
+uint8_t DALI_Input_IsEventDriven(uint8_t instanceType);
+
+// Raise the periodic report of an event driven instance once its report timer expired
+void DALI_Input_Report(uint8_t instance);
+
+// Default event filter and resolution of an instance type
+uint32_t DALI_Input_DefaultEventFilter(uint8_t instanceType);
+uint8_t DALI_Input_DefaultResolution(uint8_t instanceType);
+uint8_t DALI_Input_DefaultEventPriority(uint8_t instanceType);
+
+#endif /* INC_DALI_INPUT_H_ */
@@ -52,12 +52,51 @@ enum memory_bank_189_address
 	pidDerivativeCoeff_addr,
 	calibrateDark,
 	calibrateFullScale,
+	filterType_addr,
+	filterLength_addr,
+	filterShift_addr,
+	calibrationScale1_addr,		// Calibration of the second light sensor
+	calibrationOffset1_addr,
+	compensationControl_addr,	// Supply and temperature compensation of the light sensors
+	darkTemperatureCoeff_addr,
 	fullScaleRange_addr 	= 0x15
 };
+// Parameters in memory bank 190, the sensor linearisation table
+enum memory_bank_190_address
+{
+	linearisationPoints_addr	= 0x03,		// Number of points, writing it commits the table to flash
+	linearisationTable_addr		= 0x04		// Points of 4 bytes: input LSB, input MSB, output LSB, output MSB
+};
+// Parameters in memory bank 191, the scope capture. The bank is in RAM
+enum memory_bank_191_address
+{
+	scopeControl_addr			= 0x03,		// Writing starts a capture, reads the scope status
+	scopePeriod_addr,						// Sample period in 10 us
+	scopeChannel_addr,						// 0 for the first light sensor channel, 1 for the other channel
+	scopeBlock_addr,						// Block of the capture mapped to the window, moves on after the last window byte
+	flickerIndex_addr			= 0x08,		// Result of the last flicker analysis, LSB first, read only
+	flickerFrequency_addr		= 0x0A,
+	dispatchLatency_addr		= 0x0C,		// Longest frame to command processed time in us, LSB first, writing clears it
+	scopeWindow_addr			= 0x80		// 128 bytes of the capture, samples LSB first
+};
+#define SCOPE_BANK					191
+#define SCOPE_BLOCK_SIZE			(0x100 - scopeWindow_addr)
+#define SCOPE_BLOCKS				8		// 512 samples of 2 bytes
+// Points of the linearisation table, inputs in 16-bit oversampled counts and outputs in 10-bit inputValue
+#define LINEARISATION_MAX_POINTS	16
+#define LINEARISATION_BANK			190
+// Calibration status read at calibrateDark and calibrateFullScale
+#define CALIBRATION_DONE			0x00
+#define CALIBRATION_BUSY			0x01
+#define CALIBRATION_ERROR			0x02
+#define CALIBRATION_IDLE			0xFF	// Not requested since power up
+// Manufacturer banks implemented on this device
+#define MANUFACTURER_BANK(n)		(((n) == 189) || ((n) == LINEARISATION_BANK) || ((n) == SCOPE_BANK))
 #define MEMORY_NVM_VAR_ADDR			0x0800E800
 #define MEMORY_ROM_VAR_ADDR			0x0800EC00
 #define MEMORY_BANK_0_ADDR			0x0800F000
 #define MEMORY_BANK_189_ADDR		0x0800F400
+#define MEMORY_BANK_190_ADDR		0x0800F800
 //#define GTIN						((* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_0_addr)) | (* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_1_addr))  \
 //									| (* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_2_addr)) | (* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_3_addr)) \
 //									| (* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_4_addr)) | (* (uint8_t*) (MEMORY_BANK_0_ADDR + GTIN_5_addr)))
@@ -80,11 +119,29 @@ enum memory_bank_189_address
 #define fullScaleRange				((* (uint8_t*) (MEMORY_BANK_189_ADDR + fullScaleRange_addr + 1)) << 8) | (* (uint8_t*) (MEMORY_BANK_189_ADDR + fullScaleRange_addr))
 #define calibrationScale			(* (uint8_t*) (MEMORY_BANK_189_ADDR + calibrationScale_addr))
 #define calibrationOffset			(* (uint8_t*) (MEMORY_BANK_189_ADDR + calibrationOffset_addr))
+#define calibrationScale1			(* (uint8_t*) (MEMORY_BANK_189_ADDR + calibrationScale1_addr))
+#define calibrationOffset1			(* (uint8_t*) (MEMORY_BANK_189_ADDR + calibrationOffset1_addr))
+// Calibration of light sensor s
+#define sensorScale(s)				((s) ? calibrationScale1 : calibrationScale)
+#define sensorOffset(s)				((s) ? calibrationOffset1 : calibrationOffset)
+#define sensorScale_addr(s)			((s) ? calibrationScale1_addr : calibrationScale_addr)
+#define sensorOffset_addr(s)		((s) ? calibrationOffset1_addr : calibrationOffset_addr)
+#define compensationControl		(* (uint8_t*) (MEMORY_BANK_189_ADDR + compensationControl_addr))
+#define darkTemperatureCoeff		(* (int8_t*) (MEMORY_BANK_189_ADDR + darkTemperatureCoeff_addr))	// Dark level change in 16-bit result counts per degC
 #define pidProportionalCoeff		(* (uint8_t*) (MEMORY_BANK_189_ADDR + pidProportionalCoeff_addr))
 #define pidIntegralCoeff			(* (uint8_t*) (MEMORY_BANK_189_ADDR + pidIntegralCoeff_addr))
 #define pidDerivativeCoeff			(* (uint8_t*) (MEMORY_BANK_189_ADDR + pidDerivativeCoeff_addr))
+#define filterType					(* (uint8_t*) (MEMORY_BANK_189_ADDR + filterType_addr))
+#define filterLength				(* (uint8_t*) (MEMORY_BANK_189_ADDR + filterLength_addr))
+#define filterShift					(* (uint8_t*) (MEMORY_BANK_189_ADDR + filterShift_addr))
 #define factoryReset				(* (uint8_t*) (MEMORY_BANK_189_ADDR + factoryReset_addr))
 #define parameterLock				(* (uint8_t*) (MEMORY_BANK_189_ADDR + parameterLock_addr))
+#define scopePeriod					(memory_bank_191[scopePeriod_addr])
+#define scopeChannel				(memory_bank_191[scopeChannel_addr])
+#define scopeBlock					(memory_bank_191[scopeBlock_addr])
+#define linearisationPoints			(* (uint8_t*) (MEMORY_BANK_190_ADDR + linearisationPoints_addr))
+#define linearisationInput(k)		(* (uint16_t*) (MEMORY_BANK_190_ADDR + linearisationTable_addr + 4*(k)))
+#define linearisationOutput(k)		(* (uint16_t*) (MEMORY_BANK_190_ADDR + linearisationTable_addr + 4*(k) + 2))
 
 typedef struct
 {
@@ -94,6 +151,12 @@ typedef struct
 
 extern uint8_t darkCalibrate;
 extern uint8_t fullScaleCalibrate;
+// Status of the last dark and full scale calibration, read back at calibrateDark and calibrateFullScale
+extern uint8_t calibrationStatus[2];
+extern uint8_t scopeRequest;
+// Header of memory bank 191, the capture itself is read from the ADC scope buffer
+extern uint8_t memory_bank_191[dispatchLatency_addr + 2];
+extern uint8_t lock_byte[256];
 /*
  * Initialize dali memory bank
  */
@@ -127,8 +190,25 @@ uint8_t dali_memory_write(uint8_t memory_bank_number, uint8_t memory_offset, uin
  * Need to split the write function into 2 functions because the device need to response with an
  * answer in 13ms, so the first function check if the memory bank location is legit and this function
  * does the actual writing
+ * Writes to the linearisation bank are staged in RAM by dali_memory_write, the write of the number
+ * of points erases and programs the whole bank once
  */
 void memory_write(uint8_t memory_bank_number, uint8_t memory_offset, uint8_t data);
+
+/*
+ * Write several locations of one memory bank with a single erase and program of its page
+ * Parameters:	memory bank number: the memory bank number
+ * 				count: number of locations
+ * 				memory_offset, data: location and value of each byte
+ */
+void memory_write_bytes(uint8_t memory_bank_number, uint8_t count, const uint8_t *memory_offset, const uint8_t *data);
+
+/*
+ * Read a byte of the scope window of memory bank 191 without the checks of dali_memory_read.
+ * Reading the last window byte moves the window on to the next block
+ * Parameters:	memory_offset: window location, scopeWindow_addr to 0xFF
+ */
+uint8_t dali_memory_scope_read(uint8_t memory_offset);
 /*
  * Erase a page memory
  * Parameters: pointer to the variables array
@@ -0,0 +1,119 @@
+/*
+ * dali_timing.h
+ * This file provides the timing model of the DALI-2 physical and link layers.
+ * Every time and window is given in microseconds as IEC 62386-101 states it and
+ * converted to TIM2/TIM3 counts at compile time for the tick in TIM_DALI_HZ
+ */
+
+#ifndef INC_DALI_TIMING_H_
+#define INC_DALI_TIMING_H_
+
+#include "tim.h"
+
+// Timer counts of a time in ns or us, rounded to the nearest count
+#define DALI_NS(ns)						((uint32_t)(((uint64_t)(ns)*TIM_DALI_HZ + 500000000ULL)/1000000000ULL))
+#define DALI_US(us)						DALI_NS((uint64_t)(us)*1000)
+
+/********************** TRANSMITTING TIME DEFINTIONS ***************************/
+// Half a bit at 1200 bit/s, 416.7us
+#define TE								DALI_NS(416667)
+// Time for collision detection and collision recovery. The transmitted half bits
+// are accepted within 60us of TE, two half bits within 110us of 2TE
+#define TE_TX_MIN						(TE - DALI_US(60))				// 356.7 us
+#define TE_TX_MAX						(TE + DALI_US(60))				// 476.7 us
+#define TE2_TX_MIN						(2*TE - DALI_US(110))			// 723.3 us
+#define TE2_TX_MAX						(2*TE + DALI_US(110))			// 943.3 us
+#define TE_BREAK						DALI_US(1300)
+#define TE_RECOVERY						DALI_US(4300)
+// The recovery time is drawn within this distance of TE_RECOVERY
+#define TE_RECOVERY_JITTER				DALI_US(175)
+// The settling times are counted from the end of the stop condition, which the
+// state machine detects about 6TE after the last edge of a frame
+#define TE_STOP_CONDITION				(6*TE)
+// Settling time between a forward frame and its backward frame, 5.5 ms to 10.5 ms.
+// The nominal value is somewhere in between
+#define TE_TX_WAIT_BF_MIN				(DALI_US(5500) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_BF					(DALI_US(7500) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_BF_MAX				(DALI_US(10500) - TE_STOP_CONDITION)
+// Settling time between any frame and a forward frame of priority 1 to 5. The
+// start time is drawn at random within the window of the frame priority
+#define TE_TX_WAIT_FF1_MIN				(DALI_US(13500) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF1					(DALI_US(14025) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF1_MAX				(DALI_US(14700) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF2_MIN				(DALI_US(14900) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF2					(DALI_US(15288) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF2_MAX				(DALI_US(16100) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF3_MIN				(DALI_US(16300) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF3					(DALI_US(17125) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF3_MAX				(DALI_US(17700) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF4_MIN				(DALI_US(17900) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF4					(DALI_US(18525) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF4_MAX				(DALI_US(19300) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF5_MIN				(DALI_US(19500) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF5					(DALI_US(20125) - TE_STOP_CONDITION)
+#define TE_TX_WAIT_FF5_MAX				(DALI_US(21100) - TE_STOP_CONDITION)
+// Beyond this the bus is idle, whatever frame comes next
+#define TE_TX_WAIT_FF_MAX				(DALI_US(75000) - TE_STOP_CONDITION)
+
+// During transmission on the DALI bus the firmware does collision detection. In
+// doing so, it expects to see on the RX pin the value that is set on the TX pin.
+// However, the bus takes a while to respond (depending on the driver strength,
+// bus capacitance and power supply). Also during the time that we're driving the
+// line we don't expect to see any transitions.
+// The implementation is that we define a 150us window during which we expect a
+// transition if one was generated. If no such transition occurs, or transitions
+// occur outside this window, a collision is signaled.
+#define TE_TRANSITION_VALID_MAX			DALI_US(150)
+
+/*********************** RECEIVING TIME DEFINTIONS ****************************/
+// The max time the bus line can go without transition during DALI frame reception
+// should be max time for 2 half bits (unless the stop bits).
+// If the external interrupt is triggered during this 4 Te period, the timer
+// register is compared to these 4 values and if it falls within [TE_RX_MIN, TE_RX_MAX]
+// a single Te is considered to have elapsed, whereas if it falls within
+// [TE2_RX_MIN, TE2_RX_MAX], 2 Te is considered to have elapsed. Otherwise, a reception
+// error is signaled.
+// The receiver accepts 333.3us to 500us and 666.7us to 1000us. The windows are widened
+// to compensate for the difference between up and down transition due to the RC filter
+#define TE_RX_SKEW						DALI_NS(37500)
+#define TE2_RX_SKEW						DALI_NS(25000)
+#define TE_RX_MIN						(DALI_NS(333333) - TE_RX_SKEW)
+#define TE_RX_MAX						(DALI_US(500) + TE_RX_SKEW)
+#define TE2_RX_MIN						(DALI_NS(666667) - TE2_RX_SKEW)
+#define TE2_RX_MAX						(DALI_US(1000) + TE2_RX_SKEW)
+#define TE_STOP_MIN						DALI_US(2400)
+// TIM2 does not count from the start bit edge until the core is out of STOP, the time is added to the
+// first half of the start bit. Regulator and HSI wakeup (tWUSTOP) plus the instructions up to DALIStopWake
+#define TE_STOP_WAKE					DALI_US(6)
+
+// Time a backward frame is waited for after its forward frame
+#define TE_RX_BF_MAX					(DALI_US(13400) - TE_STOP_CONDITION)
+// The second frame of a send twice command follows within 100 ms
+#define TE_RX_SEND_TWICE_FF				DALI_US(100000)
+#define TE_RX_SEND_TWICE_FF_MAX			(DALI_US(105000) - TE_STOP_CONDITION)
+
+// TIM2 counts per count of the TIM6 time base used to timestamp bus edges
+#define TIME_BASE_SCALE					(TIM_DALI_HZ/TIM_TIME_BASE_HZ)
+
+/************************** TIMING MODEL CHECKS ******************************/
+_Static_assert((TIM_DALI_HZ % TIM_TIME_BASE_HZ) == 0, "The time base must divide the link layer tick");
+_Static_assert(TE >= 100, "The link layer tick is too slow to resolve the half bits");
+// TIM3 is a 16-bit counter, it times the transmitted half bits
+_Static_assert((TE + TE_TX_MAX) <= 0xFFFF, "Transmitted half bits do not fit TIM3");
+// TIM2 holds every reload value, the time base is kept in TIM2 counts too
+_Static_assert(TE_RX_SEND_TWICE_FF_MAX <= 0xFFFFFFFF/2, "Link layer times do not fit TIM2");
+_Static_assert(TE_STOP_CONDITION + TE_TX_WAIT_FF_MAX <= 0xFFFFFFFF/2, "Settling times do not fit the time base");
+_Static_assert((TE_TX_MIN < TE) && (TE < TE_TX_MAX) && (TE_TX_MAX < TE2_TX_MIN) && (TE2_TX_MIN < 2*TE) && (2*TE < TE2_TX_MAX), "Transmit windows out of order");
+_Static_assert((TE_RX_MIN < TE) && (TE < TE_RX_MAX) && (TE_RX_MAX < TE2_RX_MIN) && (TE2_RX_MIN < 2*TE) && (2*TE < TE2_RX_MAX), "Receive windows out of order");
+_Static_assert((TE2_RX_MAX < TE_STOP_MIN) && (TE_STOP_MIN < TE_STOP_CONDITION), "Stop condition out of order");
+_Static_assert((TE_STOP_WAKE < TE_RX_MIN) && (TE_TRANSITION_VALID_MAX < TE_TX_MIN), "Edge windows too wide");
+_Static_assert(TE_RECOVERY_JITTER < TE_RECOVERY, "Collision recovery out of range");
+_Static_assert((TE_TX_WAIT_BF_MIN < TE_TX_WAIT_BF) && (TE_TX_WAIT_BF < TE_TX_WAIT_BF_MAX) && (TE_TX_WAIT_BF_MAX < TE_RX_BF_MAX), "Backward frame settling times out of order");
+_Static_assert((TE_TX_WAIT_FF1_MIN < TE_TX_WAIT_FF1) && (TE_TX_WAIT_FF1 < TE_TX_WAIT_FF1_MAX) && (TE_TX_WAIT_FF1_MAX < TE_TX_WAIT_FF2_MIN), "Priority 1 settling times out of order");
+_Static_assert((TE_TX_WAIT_FF2_MIN < TE_TX_WAIT_FF2) && (TE_TX_WAIT_FF2 < TE_TX_WAIT_FF2_MAX) && (TE_TX_WAIT_FF2_MAX < TE_TX_WAIT_FF3_MIN), "Priority 2 settling times out of order");
+_Static_assert((TE_TX_WAIT_FF3_MIN < TE_TX_WAIT_FF3) && (TE_TX_WAIT_FF3 < TE_TX_WAIT_FF3_MAX) && (TE_TX_WAIT_FF3_MAX < TE_TX_WAIT_FF4_MIN), "Priority 3 settling times out of order");
+_Static_assert((TE_TX_WAIT_FF4_MIN < TE_TX_WAIT_FF4) && (TE_TX_WAIT_FF4 < TE_TX_WAIT_FF4_MAX) && (TE_TX_WAIT_FF4_MAX < TE_TX_WAIT_FF5_MIN), "Priority 4 settling times out of order");
+_Static_assert((TE_TX_WAIT_FF5_MIN < TE_TX_WAIT_FF5) && (TE_TX_WAIT_FF5 < TE_TX_WAIT_FF5_MAX) && (TE_TX_WAIT_FF5_MAX < TE_TX_WAIT_FF_MAX), "Priority 5 settling times out of order");
+_Static_assert((TE_TX_WAIT_BF < TE_RX_SEND_TWICE_FF) && (TE_RX_SEND_TWICE_FF < TE_RX_SEND_TWICE_FF_MAX + TE_STOP_CONDITION), "Send twice window out of order");
+
+#endif /* INC_DALI_TIMING_H_ */
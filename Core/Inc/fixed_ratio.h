@@ -0,0 +1,38 @@
+/*
+ * fixed_ratio.h
+ * This file provides the division-free ratios of the sample path. Cortex-M0 has neither a
+ * hardware divider nor a 32x32->64 bit multiply, floor(x*numerator/divisor) for a ratio known
+ * in advance is a 32-bit multiply by the rounded down reciprocal, a shift and one correction
+ */
+
+#ifndef INC_FIXED_RATIO_H_
+#define INC_FIXED_RATIO_H_
+
+#include "stdint.h"
+
+// floor(x*numerator/divisor) with mul = fixed_ratio_mul(numerator, divisor, shift).
+// Exact as long as x < 2^shift and both x*mul and x*numerator fit in 32 bits
+static inline uint32_t fixed_ratio(uint32_t x, uint32_t numerator, uint32_t divisor, uint32_t mul, uint8_t shift)
+{
+	uint32_t q = (x * mul) >> shift;
+	// mul is rounded down, with x below 2^shift the estimate is the quotient or one below it
+	if(x * numerator - q * divisor >= divisor)
+		q++;
+	return q;
+}
+
+// Multiplier of fixed_ratio, computed when the ratio changes and not per sample.
+// numerator*2^shift must fit in 32 bits
+static inline uint32_t fixed_ratio_mul(uint32_t numerator, uint32_t divisor, uint8_t shift)
+{
+	return (numerator << shift) / divisor;
+}
+
+// Smallest x for which floor(x*numerator/divisor) reaches quotient. Inputs from there on
+// are clamped by the caller, which keeps x*mul in 32 bits for small divisors
+static inline uint32_t fixed_ratio_limit(uint32_t numerator, uint32_t divisor, uint32_t quotient)
+{
+	return (quotient * divisor + numerator - 1) / numerator;
+}
+
+#endif /* INC_FIXED_RATIO_H_ */
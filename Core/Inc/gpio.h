@@ -40,20 +40,56 @@ void MX_GPIO_Init(void);
 /* USER CODE BEGIN Prototypes */
 void writePin(uint16_t pin, uint8_t PinState);
 uint8_t readPin(uint16_t pin);
+
+// The DALI pins are accessed from the ISRs through their registers, port and pin are fixed at build time
+__STATIC_FORCEINLINE void dali_tx_write(uint8_t PinState)
+{
+	if(PinState != 0)
+		TX_GPIO_Port->BSRR = TX_Pin;
+	else
+		TX_GPIO_Port->BRR = TX_Pin;
+}
+
+__STATIC_FORCEINLINE uint8_t dali_rx_read(void)
+{
+	return (RX_GPIO_Port->IDR & RX_Pin) != 0;
+}
+
+// Rx_Pin use EXTI line 10
 // Check whether external interrupt is configured to trigger on the DALI falling edge
-bool_t int_dali_is_falling();
+__STATIC_FORCEINLINE bool_t int_dali_is_falling(void)
+{
+	return (EXTI->FTSR & RX_Pin) != 0;
+}
 
 // Check whether external interrupt is configured to trigger on the DALI rising edge
-bool_t int_dali_is_rising();
+__STATIC_FORCEINLINE bool_t int_dali_is_rising(void)
+{
+	return (EXTI->RTSR & RX_Pin) != 0;
+}
 
 // Configure external interrupt to trigger on the DALI falling edge
-void int_dali_falling();
+__STATIC_FORCEINLINE void int_dali_falling(void)
+{
+	EXTI->FTSR |= RX_Pin;
+	EXTI->RTSR &= ~RX_Pin;
+}
 
 // Configure external interrupt to trigger on the DALI rising edge
-void int_dali_rising();
+__STATIC_FORCEINLINE void int_dali_rising(void)
+{
+	EXTI->RTSR |= RX_Pin;
+	EXTI->FTSR &= ~RX_Pin;
+}
 
 // Toggle external interrupt edge
-void int_dali_toggle();
+__STATIC_FORCEINLINE void int_dali_toggle(void)
+{
+	if(int_dali_is_falling())
+		int_dali_rising();
+	else
+		int_dali_falling();
+}
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -0,0 +1,39 @@
+/*
+ * low_power.h
+ * This file implements the STOP mode idle of the main loop. The RTC runs from the LSI
+ * and wakes the core up for the next software timer deadline or the next light sensor
+ * sample, the DALI RX edge wakes it up for a frame
+ */
+
+#ifndef INC_LOW_POWER_H_
+#define INC_LOW_POWER_H_
+
+#include "stdint.h"
+
+// Uncomment to let the main loop enter STOP while the bus is idle. The light sensor is then
+// sampled once per LOW_POWER_SAMPLE_PERIOD instead of continuously, which slows its filter
+// and hysteresis response down by the same factor
+//#define LOW_POWER_STOP
+
+// STOP is only worth it when the next deadline is at least this far, ms
+#define LOW_POWER_MIN_STOP			5
+// Longest STOP in ms, one light sensor result is taken between two. Well below the 2 s of the IWDG
+#define LOW_POWER_SAMPLE_PERIOD		100
+// LSI frequency assumed until it is measured, Hz
+#define LOW_POWER_LSI_DEFAULT		40000
+// The RTC sub-second counter runs at the LSI frequency
+#define LOW_POWER_RTC_PREDIV_S		0x7FFF
+
+/**********************Public function definitions*****************************/
+
+// Start the RTC on the LSI and measure the LSI against the time base
+void low_power_init(void);
+
+// Enter STOP until the next deadline when the bus, the ADC and the timers allow it.
+// Returns 0 without sleeping otherwise, the main loop then sleeps as before
+uint8_t low_power_stop(void);
+
+// Clear the RTC alarm, called from the RTC ISR
+void low_power_alarm(void);
+
+#endif /* INC_LOW_POWER_H_ */
@@ -58,12 +58,19 @@ typedef enum
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void SystemClock_Config(void);
 
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
 #define AOUT_Pin GPIO_PIN_1
 #define AOUT_GPIO_Port GPIOA
+#define BUTTON_Pin GPIO_PIN_2
+#define BUTTON_GPIO_Port GPIOA
+#define BUTTON_EXTI_IRQn EXTI2_3_IRQn
+#define PIR_Pin GPIO_PIN_3
+#define PIR_GPIO_Port GPIOA
+#define PIR_EXTI_IRQn EXTI2_3_IRQn
 #define SENSOR_CONFIG_Pin GPIO_PIN_4
 #define SENSOR_CONFIG_GPIO_Port GPIOA
 #define SENSOR_Pin GPIO_PIN_1
@@ -78,8 +85,22 @@ void Error_Handler(void);
 #define TP_Pin GPIO_PIN_0
 #define TP_GPIO_Port GPIOB
 /* USER CODE BEGIN Private defines */
+// Interrupt priorities, 0 is the highest of the four levels:
+// 0	DALI RX edge, timestamp only
+// 1	TIM2, link layer timing and the decoding of the captured edges
+// 2	Housekeeping: time base, software timers, ADC and its DMA, button and PIR inputs, RTC alarm
+// 3	PendSV, command dispatch
+// Uncomment to run the core at 48MHz from the PLL, for lower interrupt latency and more headroom
+// for the light sensor processing. The timers are prescaled to the same ticks in both profiles.
+// Requires LOW_POWER_STOP, the idle loop only falls back to the HSI in STOP and the PLL restarts
+// on wakeup. Without it the core would idle at 48MHz, the build stops with an error instead
+//#define CLOCK_PROFILE_48MHZ
+#ifdef CLOCK_PROFILE_48MHZ
+#define SYSCLK_HZ						48000000
+#else
+#define SYSCLK_HZ						8000000
+#endif
 extern volatile uint8_t adc_flag;
-extern volatile uint16_t adc_time;
 #ifdef DEBUG
 extern volatile uint8_t power_down;
 extern volatile uint16_t time1;
@@ -0,0 +1,56 @@
+/*
+ * soft_timer.h
+ * This file implements the software timers of the application. The running timers are
+ * kept in a heap ordered by deadline and TIM14 channel 1 compares against the earliest one,
+ * so the core only wakes up when a timer expires instead of on every millisecond
+ */
+
+#ifndef INC_SOFT_TIMER_H_
+#define INC_SOFT_TIMER_H_
+
+#include "stdint.h"
+
+// Running timers at the same time, there is one soft_timer_t per countdown of the application
+#define SOFT_TIMER_MAX				32
+
+typedef struct soft_timer soft_timer_t;
+typedef void (*soft_timer_callback_t)(soft_timer_t *timer);
+
+struct soft_timer
+{
+	uint32_t				deadline;		// soft_timer_now() value at which the timer expires
+	soft_timer_callback_t	callback;		// Called from the TIM14 ISR, NULL when only soft_timer_running is checked
+	uint8_t					slot;			// Position in the deadline heap plus one, 0 while stopped
+};
+
+/**********************Public function definitions*****************************/
+
+// Start TIM14 and move the HAL tick over to it, SysTick is stopped
+void soft_timer_init(void);
+
+// Milliseconds since soft_timer_init, wraps after 49 days
+uint32_t soft_timer_now(void);
+
+// (Re)start a timer to expire in ms milliseconds. A time of 0 stops it, as the countdowns it replaces did.
+// ISR safe
+void soft_timer_start(soft_timer_t *timer, uint32_t ms, soft_timer_callback_t callback);
+
+// Stop a timer without calling its callback. ISR safe
+void soft_timer_stop(soft_timer_t *timer);
+
+// Returns 1 while the timer has not expired
+uint8_t soft_timer_running(soft_timer_t const *timer);
+
+// Milliseconds until the earliest deadline, 0 when one is due and 0xFFFFFFFF when no timer runs
+uint32_t soft_timer_next(void);
+
+// Move the time on by ms that TIM14 did not count, while the core was in STOP. Call with interrupts disabled
+void soft_timer_skip(uint32_t ms);
+
+// Extend the TIM14 counter to 32 bits, called on its update interrupt
+void soft_timer_overflow(void);
+
+// Call the callbacks of the expired timers and compare against the next deadline, called on the TIM14 CC1 interrupt
+void soft_timer_handler(void);
+
+#endif /* INC_SOFT_TIMER_H_ */
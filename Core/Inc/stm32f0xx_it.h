@@ -52,7 +52,10 @@ void HardFault_Handler(void);
 void SVC_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void DMA1_Channel1_IRQHandler(void);
+void EXTI2_3_IRQHandler(void);
 void EXTI4_15_IRQHandler(void);
+void ADC1_COMP_IRQHandler(void);
 void TIM2_IRQHandler(void);
 void TIM6_DAC_IRQHandler(void);
 void TIM14_IRQHandler(void);
@@ -34,8 +34,18 @@ extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim3;
 extern TIM_HandleTypeDef htim6;
 extern TIM_HandleTypeDef htim14;
+extern TIM_HandleTypeDef htim15;
 
 /* USER CODE BEGIN Private defines */
+// Counter clocks of the timers, the same in every clock profile
+#define TIM_DALI_HZ					8000000		// tim2 and tim3, the link layer timing is counted in these ticks
+#define TIM_TIME_BASE_HZ			2000000		// tim6
+#define TIM_SOFT_TIMER_HZ			1000		// tim14
+#define TIM_ADC_TRIGGER_HZ			1000000		// tim15, divided by its period of 1000
+#define TIM_PRESCALER(hz)			(SYSCLK_HZ/(hz) - 1)
+#if (SYSCLK_HZ % TIM_DALI_HZ) != 0
+#error "The system clock must be a multiple of the link layer tick"
+#endif
 
 /* USER CODE END Private defines */
 
@@ -43,15 +53,58 @@ void MX_TIM2_Init(void);
 void MX_TIM3_Init(void);
 void MX_TIM6_Init(void);
 void MX_TIM14_Init(void);
+void MX_TIM15_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-// Use tim2 for TX, tim3 for keeping track of time on RX, tim14 for quiescent timer and initialise timer
+// Use tim2 for TX, tim3 for keeping track of time on RX, tim14 counts milliseconds for the software timers,
+// tim15 triggers the ADC scans at 1kHz
 void set_timer_reload_val(uint32_t timer_val, TIM_HandleTypeDef* htim);
 void reset_timer(TIM_HandleTypeDef* htim);
 uint32_t get_timer_count(TIM_HandleTypeDef* htim);
 void disable_timer_int(TIM_HandleTypeDef* htim);
 void enable_timer_int(TIM_HandleTypeDef* htim);
 void set_timer_count(uint32_t timer_val, TIM_HandleTypeDef* htim);
+// Register level access to tim2 and tim3 for the DALI ISRs, the same operations as above without the calls
+__STATIC_FORCEINLINE void tim2_set_reload(uint32_t timer_val)
+{
+	TIM2->ARR = timer_val;
+}
+__STATIC_FORCEINLINE void tim2_reset(void)
+{
+	TIM2->CNT = 0;
+}
+__STATIC_FORCEINLINE void tim2_set_count(uint32_t timer_val)
+{
+	TIM2->CNT = timer_val;
+}
+__STATIC_FORCEINLINE uint32_t tim2_get_count(void)
+{
+	return TIM2->CNT;
+}
+__STATIC_FORCEINLINE void tim2_disable_int(void)
+{
+	TIM2->DIER &= ~TIM_DIER_UIE;
+}
+__STATIC_FORCEINLINE void tim2_enable_int(void)
+{
+	TIM2->SR = ~TIM_SR_UIF;
+	TIM2->DIER |= TIM_DIER_UIE;
+}
+__STATIC_FORCEINLINE void tim3_reset(void)
+{
+	TIM3->CNT = 0;
+}
+__STATIC_FORCEINLINE uint32_t tim3_get_count(void)
+{
+	return TIM3->CNT;
+}
+__STATIC_FORCEINLINE void tim3_set_count(uint32_t timer_val)
+{
+	TIM3->CNT = timer_val;
+}
+// tim6 runs freely at 2MHz, its update events extend it to a 32-bit time base
+void time_base_overflow(void);
+uint32_t get_time_base(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
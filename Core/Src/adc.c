@@ -21,10 +21,42 @@
 #include "adc.h"
 
 /* USER CODE BEGIN 0 */
+#include "dali.h"
+#include "dali_timing.h"
+#include "soft_timer.h"
 
+// Circular buffer, the DMA fills one half while the other is decimated
+uint16_t adc_dma_buffer[2*ADC_OVERSAMPLING*ADC_SCAN_CHANNELS];
+volatile uint16_t adc_result[ADC_SCAN_CHANNELS];
+volatile uint8_t adc_result_ready = 0;
+volatile uint8_t adc_sampled = 0;
+volatile uint8_t adc_error = 0;
+volatile uint8_t adc_sample_error = 0;
+volatile uint8_t adc_window_flag = 0;
+uint16_t adc_scope_buffer[ADC_SCOPE_SAMPLES];
+volatile uint8_t adc_scope_state = ADC_SCOPE_IDLE;
+volatile uint8_t adc_scope_flag = 0;
+uint32_t adc_scan_chselr;
+uint8_t adc_hold = 0;					// TIM15 stopped for bus activity
+uint8_t adc_hold_time = 0;				// ms since the scans were held, ADC_HOLD_RUN during the forced run
+soft_timer_t adc_bus_timer;
+void adc_bus_tick(soft_timer_t *timer);
+
+uint32_t const adc_scan_channel[ADC_SCAN_CHANNELS] = {ADC_CHANNEL_1, ADC_CHANNEL_9, ADC_CHANNEL_TEMPSENSOR, ADC_CHANNEL_VREFINT};
+uint8_t adc_reference_valid = 0;
+uint16_t adc_reference_temperature;
+uint16_t adc_reference_vrefint;
+// Compensation state, results are multiplied by adc_supply_gain (16 fraction bits) then lose adc_dark_drift
+uint8_t adc_compensation = 0;
+int8_t adc_temperature_coeff = 0;
+int32_t adc_temperature_slope = 0;		// 1/16 degC per temperature result count, 12 fraction bits
+uint32_t adc_supply_gain = 1UL << 16;
+int32_t adc_dark_drift = 0;
+int32_t adc_temperature_q4 = 0;
 /* USER CODE END 0 */
 
 ADC_HandleTypeDef hadc;
+DMA_HandleTypeDef hdma_adc;
 
 /* ADC init function */
 void MX_ADC_Init(void)
@@ -39,14 +71,14 @@ void MX_ADC_Init(void)
   hadc.Init.DataAlign = ADC_DATAALIGN_RIGHT;
   hadc.Init.ScanConvMode = ADC_SCAN_DIRECTION_FORWARD;
   hadc.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
-  hadc.Init.LowPowerAutoWait = ENABLE;
+  hadc.Init.LowPowerAutoWait = DISABLE;
   hadc.Init.LowPowerAutoPowerOff = ENABLE;
   hadc.Init.ContinuousConvMode = DISABLE;
   hadc.Init.DiscontinuousConvMode = DISABLE;
-  hadc.Init.ExternalTrigConv = ADC_SOFTWARE_START;
-  hadc.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
-  hadc.Init.DMAContinuousRequests = DISABLE;
-  hadc.Init.Overrun = ADC_OVR_DATA_PRESERVED;
+  hadc.Init.ExternalTrigConv = ADC_EXTERNALTRIGCONV_T15_TRGO;
+  hadc.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+  hadc.Init.DMAContinuousRequests = ENABLE;
+  hadc.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
   if (HAL_ADC_Init(&hadc) != HAL_OK)
   {
     Error_Handler();
@@ -67,6 +99,20 @@ void MX_ADC_Init(void)
   {
     Error_Handler();
   }
+  /** Configure for the selected ADC regular channel to be converted. 
+  */
+  sConfig.Channel = ADC_CHANNEL_TEMPSENSOR;
+  if (HAL_ADC_ConfigChannel(&hadc, &sConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /** Configure for the selected ADC regular channel to be converted. 
+  */
+  sConfig.Channel = ADC_CHANNEL_VREFINT;
+  if (HAL_ADC_ConfigChannel(&hadc, &sConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
 
 }
 
@@ -98,6 +144,26 @@ void HAL_ADC_MspInit(ADC_HandleTypeDef* adcHandle)
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     HAL_GPIO_Init(SENSOR_GPIO_Port, &GPIO_InitStruct);
 
+    /* ADC1 DMA Init */
+    /* ADC Init */
+    hdma_adc.Instance = DMA1_Channel1;
+    hdma_adc.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_adc.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_adc.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_adc.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma_adc.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_adc.Init.Mode = DMA_CIRCULAR;
+    hdma_adc.Init.Priority = DMA_PRIORITY_LOW;
+    if (HAL_DMA_Init(&hdma_adc) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(adcHandle,DMA_Handle,hdma_adc);
+
+    /* ADC1 interrupt Init */
+    HAL_NVIC_SetPriority(ADC1_COMP_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(ADC1_COMP_IRQn);
   /* USER CODE BEGIN ADC1_MspInit 1 */
 
   /* USER CODE END ADC1_MspInit 1 */
@@ -123,6 +189,11 @@ void HAL_ADC_MspDeInit(ADC_HandleTypeDef* adcHandle)
 
     HAL_GPIO_DeInit(SENSOR_GPIO_Port, SENSOR_Pin);
 
+    /* ADC1 DMA DeInit */
+    HAL_DMA_DeInit(adcHandle->DMA_Handle);
+
+    /* ADC1 interrupt Deinit */
+    HAL_NVIC_DisableIRQ(ADC1_COMP_IRQn);
   /* USER CODE BEGIN ADC1_MspDeInit 1 */
 
   /* USER CODE END ADC1_MspDeInit 1 */
@@ -130,7 +201,267 @@ void HAL_ADC_MspDeInit(ADC_HandleTypeDef* adcHandle)
 } 
 
 /* USER CODE BEGIN 1 */
+// Sum the oversampled conversions of each channel in one half of the buffer
+void adc_decimate(uint16_t * half)
+{
+	uint32_t sum[ADC_SCAN_CHANNELS] = {0};
+	for(uint8_t n = 0; n < ADC_OVERSAMPLING; n++)
+	{
+		for(uint8_t ch = 0; ch < ADC_SCAN_CHANNELS; ch++)
+		{
+			sum[ch] += *half++;
+		}
+	}
+	for(uint8_t ch = 0; ch < ADC_SCAN_CHANNELS; ch++)
+	{
+		adc_result[ch] = sum[ch];
+	}
+	adc_result_ready = 1;
+	adc_sampled = 1;
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc)
+{
+	if(adc_scope_state == ADC_SCOPE_BUSY)
+		return;
+	adc_decimate(&adc_dma_buffer[0]);
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc)
+{
+	if(adc_scope_state == ADC_SCOPE_BUSY)
+	{
+		// Stop before the next trigger, with the DMA done it would be an overrun
+		HAL_ADC_Stop_DMA(hadc);
+		adc_scope_flag = 1;
+		return;
+	}
+	adc_decimate(&adc_dma_buffer[ADC_OVERSAMPLING*ADC_SCAN_CHANNELS]);
+}
+
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef* hadc)
+{
+	if(adc_scope_state == ADC_SCOPE_BUSY)
+	{
+		HAL_ADC_Stop_DMA(hadc);
+		adc_scope_state = ADC_SCOPE_ERROR;
+		adc_scope_flag = 1;
+		return;
+	}
+	adc_error = 1;
+	adc_sample_error = 1;
+}
+
+void HAL_ADC_LevelOutOfWindowCallback(ADC_HandleTypeDef* hadc)
+{
+	// One wakeup per window, the main loop arms it again after it has looked at the value
+	__HAL_ADC_DISABLE_IT(hadc, ADC_IT_AWD);
+	adc_window_flag = 1;
+}
+
+void adc_watchdog_init(uint8_t result_index)
+{
+	ADC_AnalogWDGConfTypeDef AnalogWDGConfig = {0};
+	// Open window and no interrupt until the first adc_watchdog_arm
+	AnalogWDGConfig.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+	AnalogWDGConfig.Channel = adc_scan_channel[result_index];
+	AnalogWDGConfig.ITMode = DISABLE;
+	AnalogWDGConfig.HighThreshold = 0xFFF;
+	AnalogWDGConfig.LowThreshold = 0;
+	if (HAL_ADC_AnalogWDGConfig(&hadc, &AnalogWDGConfig) != HAL_OK)
+	{
+		adc_error = 1;
+	}
+}
+
+void adc_watchdog_arm(uint16_t low, uint16_t high)
+{
+	// TR is not locked by ADSTART, the window moves without stopping the scans
+	hadc.Instance->TR = ((uint32_t)high << 16) | low;
+	__HAL_ADC_CLEAR_FLAG(&hadc, ADC_FLAG_AWD);
+	__HAL_ADC_ENABLE_IT(&hadc, ADC_IT_AWD);
+}
+
+void adc_watchdog_disarm(void)
+{
+	__HAL_ADC_DISABLE_IT(&hadc, ADC_IT_AWD);
+}
+
+void adc_start(void)
+{
+	HAL_ADC_Stop_DMA(&hadc);
+	// Calibration needs the ADC disabled, it takes about 6us
+	HAL_ADCEx_Calibration_Start(&hadc);
+	adc_reference_valid = 0;
+	if(HAL_ADC_Start_DMA(&hadc, (uint32_t*) adc_dma_buffer, sizeof(adc_dma_buffer)/sizeof(adc_dma_buffer[0])) != HAL_OK)
+	{
+		adc_error = 1;
+		adc_sample_error = 1;
+	}
+}
 
+void adc_suspend(void)
+{
+	// The ADC has to be disabled for STOP, the calibration and the references are kept
+	HAL_ADC_Stop_DMA(&hadc);
+}
+
+void adc_resume(void)
+{
+	adc_sampled = 0;
+	if(HAL_ADC_Start_DMA(&hadc, (uint32_t*) adc_dma_buffer, sizeof(adc_dma_buffer)/sizeof(adc_dma_buffer[0])) != HAL_OK)
+	{
+		adc_error = 1;
+		adc_sample_error = 1;
+	}
+}
+
+void adc_check_drift(void)
+{
+	uint16_t temperature = adc_result[ADC_RESULT_TEMPERATURE];
+	uint16_t vrefint = adc_result[ADC_RESULT_VREFINT];
+	// The first result after calibration is the reference for the drift
+	if(adc_reference_valid == 0)
+	{
+		adc_reference_temperature = temperature;
+		adc_reference_vrefint = vrefint;
+		adc_reference_valid = 1;
+		return;
+	}
+	if((temperature > adc_reference_temperature + ADC_DRIFT_TEMPERATURE) || (temperature + ADC_DRIFT_TEMPERATURE < adc_reference_temperature) \
+			|| (vrefint > adc_reference_vrefint + ADC_DRIFT_VREFINT) || (vrefint + ADC_DRIFT_VREFINT < adc_reference_vrefint))
+	{
+		adc_start();
+	}
+}
+
+void adc_compensation_configure(uint8_t control, int8_t temperatureCoeff)
+{
+	// Blank on devices initialised before the compensation existed
+	if(control == 0xFF)
+		control = 0;
+	adc_compensation = control;
+	adc_temperature_coeff = temperatureCoeff;
+	// The factory points are apart by ADC_TS_CAL_SPAN degC, the sensor voltage falls as it gets warmer
+	int32_t span = 16*((int32_t)ADC_TS_CAL2 - ADC_TS_CAL1);
+	adc_temperature_slope = (span == 0) ? 0 : ((16*ADC_TS_CAL_SPAN) << 12) / span;
+	adc_supply_gain = 1UL << 16;
+	adc_dark_drift = 0;
+}
+
+void adc_compensation_update(void)
+{
+	/*
+	 * VDDA = 3.3 V * VREFINT_CAL / VREFINT, a result taken at VDDA is scaled to 3.3 V by
+	 * 16*VREFINT_CAL / vrefint. This is the only division, the light results only multiply.
+	 * The temperature sensor is scaled the same way before it is compared to its factory points.
+	 */
+	uint32_t vrefint = adc_result[ADC_RESULT_VREFINT];
+	uint32_t gain = (vrefint == 0) ? (1UL << 16) : (((16UL*ADC_VREFINT_CAL) << 16) / vrefint);
+	int32_t temperature = (int32_t)(((uint64_t)adc_result[ADC_RESULT_TEMPERATURE] * gain) >> 16) - 16*ADC_TS_CAL1;
+	adc_temperature_q4 = (temperature * adc_temperature_slope) >> 12;
+	adc_supply_gain = (adc_compensation & ADC_COMPENSATE_SUPPLY) ? gain : (1UL << 16);
+	adc_dark_drift = (adc_compensation & ADC_COMPENSATE_TEMPERATURE) ? ((adc_temperature_coeff * adc_temperature_q4) >> 4) : 0;
+}
+
+uint16_t adc_compensate(uint16_t sample)
+{
+	int32_t value = (int32_t)(((uint64_t)sample * adc_supply_gain) >> 16) - adc_dark_drift;
+	if(value < 0)
+		value = 0;
+	if(value > 0xFFFF)
+		value = 0xFFFF;
+	return value;
+}
+
+void adc_compensate_window(uint16_t *low, uint16_t *high)
+{
+	// Inverse of adc_compensate on 12-bit counts, widened by one count so that rounding never hides a change
+	int32_t drift = adc_dark_drift / 16;
+	int32_t compensatedLow = *low + drift;
+	int32_t compensatedHigh = *high + drift;
+	int32_t rawLow = (compensatedLow <= 0) ? 0 : ((compensatedLow << 16) / (int32_t)adc_supply_gain - 1);
+	int32_t rawHigh = (compensatedHigh <= 0) ? 1 : ((compensatedHigh << 16) / (int32_t)adc_supply_gain + 1);
+	*low = (rawLow < 0) ? 0 : ((rawLow > 0xFFF) ? 0xFFF : rawLow);
+	*high = (rawHigh > 0xFFF) ? 0xFFF : rawHigh;
+}
+
+void adc_bus_hold(void)
+{
+	// A capture needs evenly spaced samples, and a forced run must get its result out
+	if((adc_hold == 1) || (adc_hold_time != 0) || (adc_scope_state == ADC_SCOPE_BUSY))
+		return;
+	// The trigger timer stops counting, the scan in progress if any still completes
+	__HAL_TIM_DISABLE(&htim15);
+	adc_hold = 1;
+	soft_timer_start(&adc_bus_timer, 1, adc_bus_tick);
+}
+
+void adc_bus_tick(soft_timer_t *timer)
+{
+	// The forced run is over
+	if(adc_hold == 0)
+	{
+		adc_hold_time = 0;
+		return;
+	}
+	adc_hold_time++;
+	// The RX edges preempt this callback and may hold again. The bus is checked and the hold
+	// released in one go, an edge in between would otherwise be lost with the released hold
+	__disable_irq();
+	uint8_t quiet = DALIBusQuiet(ADC_BUS_SETTLE);
+	uint8_t release = quiet || (adc_hold_time >= ADC_HOLD_MAX);
+	if(release)
+	{
+		__HAL_TIM_ENABLE(&htim15);
+		adc_hold = 0;
+		adc_hold_time = quiet ? 0 : ADC_HOLD_RUN;
+	}
+	__enable_irq();
+	soft_timer_start(timer, release ? adc_hold_time : 1, adc_bus_tick);
+}
+
+void adc_scope_start(uint8_t result_index, uint8_t period)
+{
+	if(adc_scope_state == ADC_SCOPE_BUSY)
+		return;
+	if(period < ADC_SCOPE_MIN_PERIOD)
+		period = ADC_SCOPE_MIN_PERIOD;
+	HAL_ADC_Stop_DMA(&hadc);
+	adc_watchdog_disarm();
+	// One channel into the scope buffer, the DMA stops when it is full
+	adc_scan_chselr = hadc.Instance->CHSELR;
+	hadc.Instance->CHSELR = ADC_CHSELR_CHANNEL(adc_scan_channel[result_index]);
+	hdma_adc.Init.Mode = DMA_NORMAL;
+	HAL_DMA_Init(&hdma_adc);
+	__HAL_TIM_SET_AUTORELOAD(&htim15, ADC_SCOPE_TICKS*period - 1);
+	__HAL_TIM_SET_COUNTER(&htim15, 0);
+	__HAL_TIM_ENABLE(&htim15);
+	adc_hold = 0;
+	adc_hold_time = 0;
+	soft_timer_stop(&adc_bus_timer);
+	adc_scope_flag = 0;
+	adc_scope_state = ADC_SCOPE_BUSY;
+	if(HAL_ADC_Start_DMA(&hadc, (uint32_t*) adc_scope_buffer, ADC_SCOPE_SAMPLES) != HAL_OK)
+	{
+		adc_scope_state = ADC_SCOPE_ERROR;
+		adc_scope_flag = 1;
+	}
+}
+
+void adc_scope_finish(void)
+{
+	HAL_ADC_Stop_DMA(&hadc);
+	hadc.Instance->CHSELR = adc_scan_chselr;
+	hdma_adc.Init.Mode = DMA_CIRCULAR;
+	HAL_DMA_Init(&hdma_adc);
+	__HAL_TIM_SET_AUTORELOAD(&htim15, htim15.Init.Period);
+	__HAL_TIM_SET_COUNTER(&htim15, 0);
+	if(adc_scope_state == ADC_SCOPE_BUSY)
+		adc_scope_state = ADC_SCOPE_DONE;
+	// The scans carry on with the calibration and drift references they had, only drift recalibrates
+	adc_resume();
+}
 /* USER CODE END 1 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
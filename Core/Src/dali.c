@@ -8,6 +8,7 @@
  */
 
 #include "dali.h"
+#include "dali_timing.h"
 #include "stm32f0xx_hal.h"
 #include "stdlib.h"
 #include "time.h"
@@ -15,72 +16,13 @@
 #define DALI_HI							0
 #define DALI_LO                         1
 
-/********************** TRANSMITTING TIME DEFINTIONS ***************************/
-// The number of timer counts that make up a 416.6us delay. The timer is configured
-// to run at 8MHz, thus the count is 8*416.6 = 3333
-
-#define TE                              3333
-// Time for collision detection and collision recovery
-#define TE_TX_MIN						2854	// 356.7 us
-#define TE_TX_MAX						3814	// 476.7 us
-#define TE2_TX_MIN						5787	// 723.3 us
-#define TE2_TX_MAX						7546	// 943.3 us
-#define TE_BREAK						10400	// 1.3 ms
-#define TE_RECOVERY						34400	// 4.3 ms
-//The number of timer counts for settling time between forward frame and backward frame
-#define TE_TX_WAIT_BF_MAX				64000	// 10.5 ms - 6TE (3 stop bits)
-#define TE_TX_WAIT_BF					40000	// A random number between the max and min value
-#define TE_TX_WAIT_BF_MIN				24000	// 5.5 ms - 6TE
-//The number of timer counts for settling time between any frame and forward frame
-#define TE_TX_WAIT_FF1_MIN				88000	// 13.5 ms - 6TE
-#define TE_TX_WAIT_FF1					92200	// Random between min and max
-#define TE_TX_WAIT_FF1_MAX				97600	// 14.7 ms - 6TE
-#define TE_TX_WAIT_FF2_MIN				99200	// 14.9 ms - 6TE
-#define TE_TX_WAIT_FF2					102300
-#define TE_TX_WAIT_FF2_MAX				108800	// 16.1 ms - 6TE
-#define TE_TX_WAIT_FF3_MIN				110400	// 16.3 ms - 6TE
-#define TE_TX_WAIT_FF3					117000
-#define TE_TX_WAIT_FF3_MAX				121600	// 17.7 ms - 6TE
-#define TE_TX_WAIT_FF4_MIN				123200	// 17.9 ms - 6TE
-#define TE_TX_WAIT_FF4					128200
-#define TE_TX_WAIT_FF4_MAX				134400	// 19.3 ms - 6TE
-#define TE_TX_WAIT_FF5_MIN				136000	// 19.5 ms - 6TE
-#define TE_TX_WAIT_FF5					141000
-#define TE_TX_WAIT_FF5_MAX				148800	// 21.1 ms - 6TE
-#define TE_TX_WAIT_FF_MAX				580000	// 75 ms - 6TE
-
-// During transmission on the DALI bus the firmware does collision detection. In
-// doing so, it expects to see on the RX pin the value that is set on the TX pin.
-// However, the bus takes a while to respond (depending on the driver strength,
-// bus capacitance and power supply). Also during the time that we're driving the
-// line we don't expect to see any transitions.
-// The implementation is that we define a 150us window during which we expect a
-// transition if one was generated. If no such transition occurs, or transitions
-// occur outside this window, a collision is signaled.
-#define TE_TRANSITION_VALID_MAX         	1200
-
-/*********************** RECEIVING TIME DEFINTIONS ****************************/
-// The max time the bus line can go without transition during DALI frame reception
-// should be max time for 2 half bits (unless the stop bits).
-// If the external interrupt is triggered during this 4 Te period, the timer
-// register is compared to these 4 values and if it falls within [TE_RX_MIN, TE_RX_MAX]
-// a single Te is considered to have elapsed, whereas if it falls within
-// [TE2_RX_MIN, TE2_RX_MAX], 2 Te is considered to have elapsed. Otherwise, a reception
-// error is signaled.
-#define TE_RX_MIN						2366	//2666	// 333.25 us  - correct value is 2666 but minus 300 to compensate for the difference between up and down transition due to RC filter
-#define TE_RX_MAX						4300	//4000	// 500 us - add 300 for - should still in grey area
-#define TE2_RX_MIN						5132	//5332	// 666.5 us - same as TE_RX_MIN
-#define TE2_RX_MAX						8200	//8000	// 1000 us - same as TE_RX_MAX
-#define TE_STOP_MIN						19200	// 2400 us
-
-#define TE_RX_BF_MAX					87200	// 13.4 ms - 6TE
-#define TE_RX_SEND_TWICE_FF				800000	// 100 ms
-#define TE_RX_SEND_TWICE_FF_MAX			820000	// 105 ms - 6TE
-
 // DALI bus decoded data is put in a circular buffer such that the application
 // can pick it up at its own pace. This is the size of this buffer.
 #define RX_QUEUE_SIZE                   20
 #define TX_QUEUE_SIZE					20
+// Edges captured by the EXTI ISR and not decoded yet. The decoder runs right after the
+// capture unless a TIM2 interrupt is in progress, a few entries are plenty
+#define RX_EDGE_QUEUE_SIZE				4
 // DALI protocol state machine flags. Most of these get reset at the start of each
 // frame and are updated as the machine advances. At the end of the frame (or
 // frames, since the machine doesn't return to ST_IDLE between a forward frame
@@ -128,14 +70,67 @@ volatile uint16_t time_int3[60];
 struct DALIRxData rxData[RX_QUEUE_SIZE];
 struct DALITxData txData[TX_QUEUE_SIZE];
 uint16_t backwardFrameDelay[RX_QUEUE_SIZE];
+uint32_t rxQueueTime[RX_QUEUE_SIZE];
 data_flags_t flagsData[RX_QUEUE_SIZE];
 volatile uint8_t rxDataR, rxDataW;
 volatile uint8_t txDataR, txDataW; // (txDataW: next empty space in the queue, txDataR: next element will be processed)
-volatile uint8_t priorityState = 1;
 volatile uint32_t overlapTime = 0;
+// Time base value of the last edge seen on the bus, whoever drove it
+volatile uint32_t lastEdgeTime = 0;
+// Random value drawn on each entry to PRE_IDLE, places the start time inside the settling window
+volatile uint32_t txJitter = 0;
+// Collision recovery time that replaces the settling time of the frame to be retransmitted
+volatile uint32_t txRecovery = 0;
+// Frame on the bus, and the copy a collision leaves to be sent again. It competes with the
+// queue by priority. Only the state machine uses them, the queue itself is never rewound
+struct DALITxData txCurrent;
+struct DALITxData txRetry;
+volatile uint8_t txRetryPending = 0;
+// Set by DALISelectTxData when txRetry and not the head of the queue is the next frame
+volatile uint8_t txFromRetry = 0;
+// Set by DALISendData, the state machine takes the new frame into account at the TIM2 priority
+volatile uint8_t txSubmitted = 0;
+// 1 when a start bit woke the core from STOP, 2 while that frame is received
+volatile uint8_t rxWakeEdge = 0;
+// DEBUG: first half of the last start bit received from STOP with TE_STOP_WAKE added, TE when it is right
+volatile uint16_t rxWakeHalfBit = 0;
+// Bus edges timestamped at the highest interrupt priority and decoded at the TIM2 priority.
+// The counters are read as they were at the edge, the level is the one after it
+typedef struct
+{
+	uint32_t time;		// Time base
+	uint32_t tim2;
+	uint16_t tim3;
+	uint8_t level;
+}rx_edge_t;
+rx_edge_t rxEdge[RX_EDGE_QUEUE_SIZE];
+volatile uint8_t rxEdgeR, rxEdgeW;
+// DEBUG: edges lost to a full capture queue
+volatile uint8_t rxEdgeOverrun = 0;
+#ifdef DEBUG
+// DEBUG: largest distance of a received half bit or two from TE or 2TE in TIM2 counts.
+// Compare it with and without interrupt load
+volatile uint16_t rxHalfBitJitter = 0;
+#endif
+// Settling time windows before a frame of each priority may start. Index 0 is used for
+// backward frames and frames without a valid priority, which are sent as priority 1
+const uint32_t txWaitFFMin[6] = {TE_TX_WAIT_FF1_MIN, TE_TX_WAIT_FF1_MIN, TE_TX_WAIT_FF2_MIN, TE_TX_WAIT_FF3_MIN, TE_TX_WAIT_FF4_MIN, TE_TX_WAIT_FF5_MIN};
+const uint32_t txWaitFFMax[6] = {TE_TX_WAIT_FF1_MAX, TE_TX_WAIT_FF1_MAX, TE_TX_WAIT_FF2_MAX, TE_TX_WAIT_FF3_MAX, TE_TX_WAIT_FF4_MAX, TE_TX_WAIT_FF5_MAX};
 
 /***********************Local function definitions*****************************/
 
+// Decode one captured bus edge, the RX half of the state machine
+void DALIRxIntHandler(rx_edge_t const *edge);
+
+// Restart TIM2 (TIM3) so that it counts from the edge being decoded instead of from now
+void DALIRestartTim2(rx_edge_t const *edge);
+void DALIRestartTim3(rx_edge_t const *edge);
+
+#ifdef DEBUG
+// DEBUG: keep the largest bit timing error of the received half bits
+void DALIRxJitter(uint32_t halfBit);
+#endif
+
 // Clear most flags such that the new frame gets a fresh start. The cable
 // connected and configuration flags remain unchanged
 void DALIClearFlags(void);
@@ -146,18 +141,51 @@ void DALIClearFlags(void);
 void DALIAppendToQueue(void);
 void DALIProcessSendData(struct DALITxData txdata);
 
+// Move the pending frame with the highest priority to the head of the TX queue. Backward
+// frames go first, then the lowest priority number; frames of equal priority keep their
+// order. A collided frame waiting in txRetry is chosen over the head when its priority is
+// the same or higher, txFromRetry records the choice for DALIStartTxData. Returns the time
+// the bus must have been quiet since its last edge before the chosen frame may start
+// (settling or recovery time plus jitter), or 0 if there is nothing to send.
+uint32_t DALISelectTxData(void);
+
+// Time elapsed since the last edge on the bus, in TIM2 counts
+uint32_t DALITimeSinceLastEdge(void);
+
+// Start transmitting the frame at the head of the TX queue. The line is checked just
+// before the start bit; if another device is already driving it the frame stays queued
+// and the machine waits in PRE_IDLE for the bus to settle again.
+void DALIStartTxData(void);
+
+// Enter PRE_IDLE and draw a new jitter for the next start time
+void DALIEnterPreIdle(void);
+
+// Keep the frame that just collided for retransmission, before the queued frames of its priority
+void DALIRetryTxData(void);
+
+// Priority 0 to 5 of a frame, backward frames are 0
+uint8_t DALITxPriority(struct DALITxData const *data);
+
+// Program a single PRE_IDLE deadline: the earliest start time of the highest priority
+// pending frame, or the end of the priority 5 window if nothing is pending.
+void DALISchedulePreIdle(void);
+
 /*************************Function implementations*****************************/
 void DALIInit(void)
 {
 	//Initialize the bus to idle state
-	writePin(TX_Pin, DALI_HI);
+	dali_tx_write(DALI_HI);
 
 	daliState = IDLE;
 	DALIFlags.flags_all = 0;
 	DALIConfigureMode(1);
 	rxDataR = 0;
 	rxDataW = 0;
+	txRetryPending = 0;
+	txFromRetry = 0;
 	srand(time(0));
+	// The bus may be in the middle of a frame at power up, wait a full settling time
+	lastEdgeTime = get_time_base();
 }
 
 void DALIConfigureMode(uint8_t mode)
@@ -168,7 +196,7 @@ void DALIConfigureMode(uint8_t mode)
 void DALICheckCable(void)
 {
 	static uint8_t cableDisconnectCounter = 0;
-	if (readPin(RX_Pin) == DALI_LO)
+	if (dali_rx_read() == DALI_LO)
 	{
 		if (cableDisconnectCounter > 0)
 		{
@@ -194,6 +222,7 @@ void DALITimerIntHandler(void)
 {
 	static uint32_t TE_random;
 	uint32_t TE_adjust;
+	uint32_t txWait;
 	switch(daliState)
 	{
 	case SEND_DATA:
@@ -203,28 +232,28 @@ void DALITimerIntHandler(void)
 		{
 		case 1:
 			// Start bit, reaches the end of 1st half, start 2nd half
-			set_timer_reload_val(TE, &htim2);
-			writePin(TX_Pin, DALI_HI);
+			tim2_set_reload(TE);
+			dali_tx_write(DALI_HI);
 			break;
 		case 2:
 			// Data bit,  start of 1st half
-			set_timer_reload_val(TE_adjust, &htim2);
+			tim2_set_reload(TE_adjust);
 			if ((txPacket & 0x800000) != 0)
 			{
 				// Send a '1' bit, which starts with a DALI_LO
-				writePin(TX_Pin, DALI_LO);
+				dali_tx_write(DALI_LO);
 			}
 			else
 			{
 				// Send a '0' bit, which starts with a DALI_HI
-				writePin(TX_Pin, DALI_HI);
+				dali_tx_write(DALI_HI);
 			}
 			prevBit = 1;
 			break;
 		case 50:
 			// STOP BIT 1, 1st half
-			set_timer_reload_val(TE_adjust, &htim2);
-			writePin(TX_Pin, DALI_HI);
+			tim2_set_reload(TE_adjust);
+			dali_tx_write(DALI_HI);
 			break;
 		case 51:
 		case 52:
@@ -233,8 +262,8 @@ void DALITimerIntHandler(void)
 		case 55:
 			// STOP BIT 1, 2nd half
 			// STOP BIT 2, 3
-			set_timer_reload_val(TE_adjust, &htim2);
-			writePin(TX_Pin, DALI_HI);
+			tim2_set_reload(TE_adjust);
+			dali_tx_write(DALI_HI);
 			// No transitions should occur, we should stay put
 			break;
 		case 56:
@@ -242,12 +271,11 @@ void DALITimerIntHandler(void)
 			// for a potential backframe. Keep timer running
 			if(DALIFlags.txFrameType == 1) // backward frame sent
 			{
-				daliState = PRE_IDLE;
-				set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
+				DALIEnterPreIdle();
 			}
 			else
 			{
-				set_timer_reload_val(TE_RX_BF_MAX, &htim2);
+				tim2_set_reload(TE_RX_BF_MAX);
 				rxPacketTime = 0;
 				daliState = WAIT_FOR_BACKFRAME;
 			}
@@ -256,12 +284,14 @@ void DALITimerIntHandler(void)
 				DALIFlags.txDone = 1;
 				DALIAppendToQueue();
 			}
+			// The application may be waiting for the frame to be out, e.g. to write the flash
+			SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 			break;
 		default:
 			// This case handles all the in-between (data) bits, with a
 			// distinction between 1st half (even halfBitNumber) and 2nd
 			// half (odd halfBitNumber) of a bit.
-			set_timer_reload_val(TE_adjust, &htim2);
+			tim2_set_reload(TE_adjust);
 			switch(halfBitNumber & 0x01)
 			{
 			case 0:
@@ -270,19 +300,19 @@ void DALITimerIntHandler(void)
 				{
 				case 0x000000:
 					// Last bit sent 0, we need to send 0
-					writePin(TX_Pin, DALI_HI);
+					dali_tx_write(DALI_HI);
 					break;
 				case 0x400000:
 					// Last bit sent 0, we need to send 1
-					writePin(TX_Pin, DALI_LO);
+					dali_tx_write(DALI_LO);
 					break;
 				case 0x800000:
 					// Last bit sent 1, we need to send 0
-					writePin(TX_Pin, DALI_HI);
+					dali_tx_write(DALI_HI);
 					break;
 				case 0xC00000:
 					// Last bit sent 1, we need to send 1
-					writePin(TX_Pin, DALI_LO);
+					dali_tx_write(DALI_LO);
 					break;
 				}
 				prevBit = (txPacket & 0x800000) ? 1 : 0;
@@ -294,11 +324,11 @@ void DALITimerIntHandler(void)
 				{
 				case 0:
 					// We're currently sending a '0'
-					writePin(TX_Pin, DALI_LO);
+					dali_tx_write(DALI_LO);
 					break;
 				case 0x800000:
 					// We're currently sending a '1'
-					writePin(TX_Pin, DALI_HI);
+					dali_tx_write(DALI_HI);
 					break;
 				}
 				break;
@@ -318,7 +348,7 @@ void DALITimerIntHandler(void)
 			// If sending 16-bit forward frame, skip to stop bit at half bit 34
 			halfBitNumber = 50;
 		}
-		time_int[halfBitNumber] = get_timer_count(&htim2);
+		time_int[halfBitNumber] = tim2_get_count();
 		break;
 	case WAIT_FOR_BACKFRAME:
 		// Time-out occurred signal the end of the period in which new frame is interpreted as backward frame
@@ -328,71 +358,59 @@ void DALITimerIntHandler(void)
 	        DALIFlags.sendTwiceFrame = 0;
 	        txPacket = txPacket_temp;
 	        halfBitNumber = 1;
-	        set_timer_reload_val(TE, &htim2);
-	        writePin(TX_Pin, DALI_LO);
+	        tim2_set_reload(TE);
+	        dali_tx_write(DALI_LO);
 		}
 		else
 		{
-			set_timer_reload_val(TE_TX_WAIT_FF1 - TE_RX_BF_MAX, &htim2);
-			daliState = PRE_IDLE;
+			DALIEnterPreIdle();
 		}
 		break;
 	case WAIT_AFTER_RX_BACKFRAME:
 		daliState = IDLE;
-		disable_timer_int(&htim2);
+		tim2_disable_int();
 		break;
 	case BREAK:
-		writePin(TX_Pin, DALI_HI);
+		dali_tx_write(DALI_HI);
 		uint8_t wait = 30;
 		while (wait--);	// Add a dummy line to make sure the bus line is released before checking it
-		if(readPin(RX_Pin) == DALI_LO)
+		if(dali_rx_read() == DALI_LO)
 		{
-			set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
+			// Another device still holds the line, use the normal settling time
+			txRecovery = 0;
 		}
 		else
 		{
 			// Set the recovery time randomly between the min and max range
 			// to avoid collisions
-			TE_random = TE_RECOVERY - 1400 + (rand() % 2800); // Between TE_RECOVERY - 1400 and TE_RECOVERY + 1400
-			set_timer_reload_val(TE_random, &htim2);
+			TE_random = TE_RECOVERY - TE_RECOVERY_JITTER + (rand() % (2*TE_RECOVERY_JITTER));
+			txRecovery = TE_random;
 		}
+		// Releasing the line is the last activity on the bus
+		lastEdgeTime = get_time_base();
 		DALIAppendToQueue();
-		daliState = PRE_IDLE;
+		DALIEnterPreIdle();
 		break;
 	case PRE_IDLE:
-		if(txDataR != txDataW) // if there is data to send
+		// Only one deadline is programmed per PRE_IDLE period, at the earliest
+		// start time of the highest priority pending frame. Edges seen since then
+		// (e.g. a cable reconnection) push the start time back.
+		txWait = DALISelectTxData();
+		if(txWait != 0)
 		{
-			if(txData[txDataR].priority <= priorityState)
+			if(txWait <= DALITimeSinceLastEdge())
 			{
-				DALIProcessSendData(txData[txDataR]);
-				txDataR = (txDataR + 1) % TX_QUEUE_SIZE;
+				DALIStartTxData();
 				return;
 			}
 		}
-		switch(priorityState)
+		else if(DALITimeSinceLastEdge() >= TE_STOP_CONDITION + TE_TX_WAIT_FF5_MAX)
 		{
-		case 1:
-			set_timer_reload_val(TE_TX_WAIT_FF2 - TE_TX_WAIT_FF1, &htim2);
-			priorityState++;
-			break;
-		case 2:
-			set_timer_reload_val(TE_TX_WAIT_FF3 - TE_TX_WAIT_FF2, &htim2);
-			priorityState++;
-			break;
-		case 3:
-			set_timer_reload_val(TE_TX_WAIT_FF4 - TE_TX_WAIT_FF3, &htim2);
-			priorityState++;
-			break;
-		case 4:
-			set_timer_reload_val(TE_TX_WAIT_FF5 - TE_TX_WAIT_FF4, &htim2);
-			priorityState++;
-			break;
-		case 5:
-			disable_timer_int(&htim2);
+			tim2_disable_int();
 			daliState = IDLE;
-			priorityState = 1;
 			break;
 		}
+		DALISchedulePreIdle();
 		break;
 	case RECEIVE_DATA:
 		/*
@@ -412,7 +430,7 @@ void DALITimerIntHandler(void)
 		    		// delay.
 			 */
 			daliState = RECEIVE_DATA_EXTRA_TE;
-			set_timer_reload_val(TE, &htim2);
+			tim2_set_reload(TE);
 		}
 		else
 		{
@@ -443,10 +461,9 @@ void DALITimerIntHandler(void)
 				{
 					DALIFlags.rxError = BIT_TIMING_ERROR;
 				}
-				set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
 				DALIFlags.rxDone = 1;
 				DALIAppendToQueue();
-				daliState = PRE_IDLE;
+				DALIEnterPreIdle();
 			}
 			else if (rxPacketLen == 24)
 			{
@@ -472,7 +489,7 @@ void DALITimerIntHandler(void)
 
 				DALIFlags.rxDone = 1;
 				// Wait to send a backward frame if needed
-				set_timer_reload_val(TE_TX_WAIT_BF, &htim2);
+				tim2_set_reload(TE_TX_WAIT_BF);
 				DALIAppendToQueue();
 				daliState = WAIT_TO_SEND_BACKFRAME;
 			}
@@ -482,9 +499,8 @@ void DALITimerIntHandler(void)
 				// frame and we need to signal an error.
 				DALIFlags.rxError = FRAME_SIZE_ERROR;
 				DALIFlags.rxDone = 1;
-				set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
 				DALIAppendToQueue();
-				daliState = PRE_IDLE;
+				DALIEnterPreIdle();
 			}
 		}
 		break;
@@ -512,10 +528,9 @@ void DALITimerIntHandler(void)
 			}
 
 
-			set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
 			DALIFlags.rxDone = 1;
 			DALIAppendToQueue();
-			daliState = PRE_IDLE;
+			DALIEnterPreIdle();
 		}
 		else if (rxPacketLen == 24)
 		{
@@ -533,7 +548,7 @@ void DALITimerIntHandler(void)
 			}
 
 			DALIFlags.rxDone = 1;
-			set_timer_reload_val(TE_TX_WAIT_BF, &htim2);
+			tim2_set_reload(TE_TX_WAIT_BF);
 			rxPacketTime = 0;
 			DALIAppendToQueue();
 			daliState = WAIT_TO_SEND_BACKFRAME;
@@ -543,9 +558,8 @@ void DALITimerIntHandler(void)
 			// Error condition, same checks as during RECEIVE_DATA
 			DALIFlags.rxError = FRAME_SIZE_ERROR;
 			DALIFlags.rxDone = 1;
-			set_timer_reload_val(TE_TX_WAIT_FF1, &htim2);
 			DALIAppendToQueue();
-			daliState = PRE_IDLE;
+			DALIEnterPreIdle();
 		}
 		break;
 	case WAIT_TO_SEND_BACKFRAME:
@@ -554,20 +568,19 @@ void DALITimerIntHandler(void)
 		// backward frame if needed
 		if(DALIFlags.receiveTwiceFrame == 1)
 		{
-			set_timer_reload_val(TE_RX_SEND_TWICE_FF - TE_TX_WAIT_BF, &htim2);
+			tim2_set_reload(TE_RX_SEND_TWICE_FF - TE_TX_WAIT_BF);
 			daliState = WAIT_FOR_SECOND_FORFRAME;
 			DALIFlags.receiveTwiceFrame = 0;
 		}
 		else
 		{
-			if((txDataR != txDataW) && (txData[txDataR].frameType == 1)) // if there is a backward frame to send
+			// The frame DALIStartTxData takes, the collided one or the head of the queue
+			if((DALISelectTxData() != 0) && (((txFromRetry != 0) ? txRetry.frameType : txData[txDataR].frameType) == 1)) // if there is a backward frame to send
 			{
-				DALIProcessSendData(txData[txDataR]);
-				txDataR = (txDataR + 1) % TX_QUEUE_SIZE;
+				DALIStartTxData();
 				return;
 			}
-			set_timer_reload_val(TE_TX_WAIT_FF1 - TE_TX_WAIT_BF, &htim2);
-			daliState = PRE_IDLE;
+			DALIEnterPreIdle();
 		}
 		break;
 	case WAIT_FOR_SECOND_FORFRAME:
@@ -575,22 +588,22 @@ void DALITimerIntHandler(void)
 		rxFrame = 0;
 		DALIFlags.rxError = FRAME_TIMING_ERROR;
 		DALIFlags.rxDone = 1;
-		set_timer_reload_val(TE_RX_SEND_TWICE_FF - TE_TX_WAIT_BF, &htim2);
 		// Add an empty message with rxError
 		DALIAppendToQueue();
-		daliState = PRE_IDLE;
+		DALIEnterPreIdle();
 		break;
 	default:
-		disable_timer_int(&htim2);
+		tim2_disable_int();
 		break;
 	}
 }
 
-void DALIRxIntHandler(void)
+void DALIRxIntHandler(rx_edge_t const *edge)
 {
 	static uint32_t tim2_value;
 	static uint16_t tim3_value;
 	static uint16_t prev_halfbit;
+	lastEdgeTime = edge->time;
 	// A time-out of TE_STOP_MIN is set every time a transition is detection
 	// Time-out means we either received a stop condition or an error
 	switch(daliState)
@@ -599,8 +612,8 @@ void DALIRxIntHandler(void)
 	case WAIT_AFTER_RX_BACKFRAME:
 	case PRE_IDLE:
 		//Make sure we're not driving the line
-		writePin(TX_Pin, DALI_HI);
-		if(readPin(RX_Pin) == DALI_HI)
+		dali_tx_write(DALI_HI);
+		if(edge->level == DALI_HI)
 		{
 			// Rising-edge detected. This should happen only when the cable has
 			// just been connected. Thus do nothing
@@ -621,9 +634,16 @@ void DALIRxIntHandler(void)
 			DALIFlags.rxFrameType = 0;
 			DALIFlags.rxSendTwicePossible = 0;
 			DALIFlags.rxFromState = daliState;
-			reset_timer(&htim2);
-			set_timer_reload_val(TE_STOP_MIN, &htim2);
-			enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+			// After a STOP wake TIM2 already counts from the edge
+			if(rxWakeEdge == 1)
+				rxWakeEdge = 2;
+			else
+			{
+				rxWakeEdge = 0;
+				DALIRestartTim2(edge);
+			}
+			tim2_set_reload(TE_STOP_MIN);
+			tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 			daliState = RECEIVE_DATA;
 		}
 		break;
@@ -634,48 +654,46 @@ void DALIRxIntHandler(void)
 
 		if(halfBitNumber == 1)	// 1st half of start bit -> not care
 		{
-			reset_timer(&htim3);
+			DALIRestartTim3(edge);
 //			prev_halfbit = halfBitNumber;
 		}
 		else
 		{
-			tim3_value = get_timer_count(&htim3);
-			tim2_value = get_timer_count(&htim2);
-			reset_timer(&htim3);
+			tim3_value = edge->tim3;
+			tim2_value = edge->tim2;
+			DALIRestartTim3(edge);
 			time_int2[halfBitNumber] = tim3_value;
 			time_int3[halfBitNumber] = tim2_value;
 
 #ifndef CONTROLLER
-			if ((tim3_value >= TE_TX_MIN) && (tim3_value <= TE_TX_MAX))// && (readPin(RX_Pin) == DALI_LO) && (halfBitNumber < 51))
+			if ((tim3_value >= TE_TX_MIN) && (tim3_value <= TE_TX_MAX))// && (edge->level == DALI_LO) && (halfBitNumber < 51))
 			{
 				// A falling edge when the bit transition from 1 to 0 is a break condition
 				// Either early in bit 0 or late in bit 1 -> if halfBitNumber is even, check next bit, else check previous bit
-				if((halfBitNumber == 2) && ((txPacket & 0x800000) == 0) && (readPin(RX_Pin) == DALI_LO))
+				if((halfBitNumber == 2) && ((txPacket & 0x800000) == 0) && (edge->level == DALI_LO))
 				{
 					DALIFlags.txError = 1;
 					DALIFlags.txDone = 0;
 					daliState = BREAK;
-					reset_timer(&htim2);
-					set_timer_reload_val(TE_BREAK, &htim2);
-					enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+					DALIRestartTim2(edge);
+					tim2_set_reload(TE_BREAK);
+					tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 					DALIAppendToQueue();
-					// Re-insert the frame to be resent
-					txDataR = (txDataR == 0) ? (TX_QUEUE_SIZE - 1) : (txDataR - 1);
-					writePin(TX_Pin, DALI_LO);
+					DALIRetryTxData();
+					dali_tx_write(DALI_LO);
 					return;
 				}
-				else if(((((halfBitNumber % 2) == 0) && ((txPacket & 0xC00000) == 0x800000)) || ((halfBitNumber % 2) && prevBit && ((txPacket & 0x800000) == 0))) && (readPin(RX_Pin) == DALI_LO))
+				else if(((((halfBitNumber % 2) == 0) && ((txPacket & 0xC00000) == 0x800000)) || ((halfBitNumber % 2) && prevBit && ((txPacket & 0x800000) == 0))) && (edge->level == DALI_LO))
 				{
 					DALIFlags.txError = 1;
 					DALIFlags.txDone = 0;
 					daliState = BREAK;
-					reset_timer(&htim2);
-					set_timer_reload_val(TE_BREAK, &htim2);
-					enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+					DALIRestartTim2(edge);
+					tim2_set_reload(TE_BREAK);
+					tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 					DALIAppendToQueue();
-					// Re-insert the frame to be resent
-					txDataR = (txDataR == 0) ? (TX_QUEUE_SIZE - 1) : (txDataR - 1);
-					writePin(TX_Pin, DALI_LO);
+					DALIRetryTxData();
+					dali_tx_write(DALI_LO);
 					return;
 				}
 				else
@@ -687,7 +705,7 @@ void DALIRxIntHandler(void)
 			{
 				// 2TE is false only if it's falling edge and prevBit = 1 or it's rising edge and prevBit = 0
 				// If the 2-bit duration is too short, adjust the TE timer accordingly
-				if((readPin(RX_Pin) == DALI_LO) && (prevBit == 1))
+				if((edge->level == DALI_LO) && (prevBit == 1))
 				{
 					if(((halfBitNumber % 2) == 1) && (tim3_value < (TE + TE_TX_MIN)))
 					{
@@ -695,11 +713,11 @@ void DALIRxIntHandler(void)
 					}
 					return;
 				}
-				else if((readPin(RX_Pin) == DALI_HI) && (prevBit == 0))
+				else if((edge->level == DALI_HI) && (prevBit == 0))
 				{
 					if(((halfBitNumber % 2) == 0) && (tim3_value > (TE + TE_TX_MAX)))
 					{
-						set_timer_count((tim2_value - (tim3_value - 2*TE)), &htim2);
+						tim2_set_count(tim2_get_count() - (tim3_value - 2*TE));
 					}
 					return;
 				}
@@ -708,13 +726,12 @@ void DALIRxIntHandler(void)
 					DALIFlags.txError = 1;
 					DALIFlags.txDone = 0;
 					daliState = BREAK;
-					reset_timer(&htim2);
-					set_timer_reload_val(TE_BREAK, &htim2);
-					enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+					DALIRestartTim2(edge);
+					tim2_set_reload(TE_BREAK);
+					tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 					DALIAppendToQueue();
-					// Re-insert the frame to be resent
-					txDataR = (txDataR == 0) ? (TX_QUEUE_SIZE - 1) : (txDataR - 1);
-					writePin(TX_Pin, DALI_LO);
+					DALIRetryTxData();
+					dali_tx_write(DALI_LO);
 					return;
 				}
 			}
@@ -723,13 +740,12 @@ void DALIRxIntHandler(void)
 				DALIFlags.txError = 1;
 				DALIFlags.txDone = 0;
 				daliState = BREAK;
-				reset_timer(&htim2);
-				set_timer_reload_val(TE_BREAK, &htim2);
-				enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+				DALIRestartTim2(edge);
+				tim2_set_reload(TE_BREAK);
+				tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 				DALIAppendToQueue();
-				// Re-insert the frame to be resent
-				txDataR = (txDataR == 0) ? (TX_QUEUE_SIZE - 1) : (txDataR - 1);
-				writePin(TX_Pin, DALI_LO);
+				DALIRetryTxData();
+				dali_tx_write(DALI_LO);
 				return;
 			}
 #endif
@@ -753,12 +769,12 @@ void DALIRxIntHandler(void)
 		DALIFlags.rxFrameType = 0;		// Assume forward frame although it should be backframe, will re-check after receive the whole frame
 		DALIFlags.rxSendTwicePossible = 0;
 		DALIFlags.rxFromState = daliState;
-		reset_timer(&htim2);
-		set_timer_reload_val(TE_STOP_MIN, &htim2);
+		DALIRestartTim2(edge);
+		tim2_set_reload(TE_STOP_MIN);
 		daliState = RECEIVE_DATA;
 		// Timer may have overflowed while we were servicing this
 		// interrupt
-		enable_timer_int(&htim2);
+		tim2_enable_int();
 		break;
 	case WAIT_TO_SEND_BACKFRAME:
 		// Transition during this state signals a frame that could be a send-twice frame
@@ -770,12 +786,12 @@ void DALIRxIntHandler(void)
 		DALIFlags.rxFrameType = 0;
 		DALIFlags.rxFromState = daliState;
 		DALIFlags.rxSendTwicePossible = 1; // This flag will tell later state to check if this frame is identical to the previous frame
-		reset_timer(&htim2);
-		set_timer_reload_val(TE_STOP_MIN, &htim2);
+		DALIRestartTim2(edge);
+		tim2_set_reload(TE_STOP_MIN);
 		daliState = RECEIVE_DATA;
 		// Timer may have overflowed while we were servicing this
 		// interrupt
-		enable_timer_int(&htim2);
+		tim2_enable_int();
 		break;
 	case WAIT_FOR_SECOND_FORFRAME:
 		// Transition during this state signals a frame that could be a send-twice frame
@@ -787,18 +803,21 @@ void DALIRxIntHandler(void)
 		DALIFlags.rxFrameType = 0;
 		DALIFlags.rxFromState = daliState;
 		DALIFlags.rxSendTwicePossible = 1; // This flag will tell later state to check if this frame is identical to the previous frame
-		reset_timer(&htim2);
-		set_timer_reload_val(TE_STOP_MIN, &htim2);
+		DALIRestartTim2(edge);
+		tim2_set_reload(TE_STOP_MIN);
 		daliState = RECEIVE_DATA;
 		// Timer may have overflowed while we were servicing this
 		// interrupt
-		enable_timer_int(&htim2);
+		tim2_enable_int();
 		break;
 	case RECEIVE_DATA:
-		tim2_value = get_timer_count(&htim2);
-		reset_timer(&htim2);
-		set_timer_reload_val(TE_STOP_MIN, &htim2);
-		enable_timer_int(&htim2);	// In case the timer generate an interrupt during this ISR
+		tim2_value = edge->tim2;
+#ifdef DEBUG
+		DALIRxJitter(tim2_value);
+#endif
+		DALIRestartTim2(edge);
+		tim2_set_reload(TE_STOP_MIN);
+		tim2_enable_int();	// In case the timer generate an interrupt during this ISR
 		switch (halfBitNumber)
 		{
 		/* There are 5 cases:
@@ -818,6 +837,11 @@ void DALIRxIntHandler(void)
 		 * We save the bit after received the first half*/
 
 		case 0:
+			if(rxWakeEdge == 2)
+			{
+				rxWakeEdge = 0;
+				rxWakeHalfBit = tim2_value;
+			}
 			if ((tim2_value >= TE_RX_MIN) && (tim2_value <= TE_RX_MAX))
 			{
 				// This is a rising at the middle of start bit so next is case 3
@@ -920,33 +944,114 @@ void DALIRxIntHandler(void)
 	}
 }
 
+void DALIRxEdgeCapture(void)
+{
+	uint8_t next = (rxEdgeW + 1) % RX_EDGE_QUEUE_SIZE;
+	if(next == rxEdgeR)
+	{
+		// The frame fails its bit timing on the missing edge
+		rxEdgeOverrun++;
+		return;
+	}
+	rx_edge_t *edge = &rxEdge[rxEdgeW];
+	edge->tim2 = tim2_get_count();
+	edge->tim3 = tim3_get_count();
+	edge->time = get_time_base();
+	edge->level = dali_rx_read();
+	rxEdgeW = next;
+	NVIC_SetPendingIRQ(TIM2_IRQn);
+}
+
+uint8_t DALIRxEdgePending(void)
+{
+	return rxEdgeR != rxEdgeW;
+}
+
+void DALIRxEdgeDecode(void)
+{
+	while(rxEdgeR != rxEdgeW)
+	{
+		DALIRxIntHandler(&rxEdge[rxEdgeR]);
+		rxEdgeR = (rxEdgeR + 1) % RX_EDGE_QUEUE_SIZE;
+	}
+}
+
+void DALIRestartTim2(rx_edge_t const *edge)
+{
+	tim2_set_count((get_time_base() - edge->time) * TIME_BASE_SCALE);
+}
+
+void DALIRestartTim3(rx_edge_t const *edge)
+{
+	// TIM3 runs freely over 16 bits and only the decoder restarts it, the edge count stays valid
+	tim3_set_count((uint16_t)(tim3_get_count() - edge->tim3));
+}
+
+#ifdef DEBUG
+void DALIRxJitter(uint32_t halfBit)
+{
+	uint32_t error = (halfBit > TE) ? (halfBit - TE) : (TE - halfBit);
+	uint32_t error2 = (halfBit > 2*TE) ? (halfBit - 2*TE) : (2*TE - halfBit);
+	if(error2 < error)
+		error = error2;
+	// Anything further off is a bit timing error, not jitter
+	if((error < TE/2) && (error > rxHalfBitJitter))
+		rxHalfBitJitter = error;
+}
+#endif
+
 /*********DALI Data transmission and reception*********/
 uint8_t DALISendData(struct DALITxData data)
 {
-	// Check if tx queue is full, if full ignore new data
-	if((txDataW + 1) % TX_QUEUE_SIZE != txDataR) // not full
+	uint8_t full;
+	uint32_t primask = __get_PRIMASK();
+	// The main loop, the dispatch and the software timers all send, a slot is claimed and filled in one go
+	__disable_irq();
+	full = ((txDataW + 1) % TX_QUEUE_SIZE == txDataR);
+	if(full == 0)
 	{
 		txData[txDataW] = data;
 		txDataW = (txDataW + 1) % TX_QUEUE_SIZE;
-		if(daliState == IDLE)
-		{
-			DALIProcessSendData(txData[txDataR]);
-			txDataR = (txDataR + 1) % TX_QUEUE_SIZE;
-		}
-		return 0;
 	}
-	else // full
+	__set_PRIMASK(primask);
+	// Even with the queue full the machine is kicked, it leaves IDLE to send what is queued
+	txSubmitted = 1;
+	NVIC_SetPendingIRQ(TIM2_IRQn);
+	return full;
+}
+
+void DALIServiceTxQueue(void)
+{
+	if(txSubmitted == 0)
+		return;
+	txSubmitted = 0;
+	if(daliState == IDLE)
 	{
-		if(daliState == IDLE)
+		uint32_t txWait = DALISelectTxData();
+		if(txWait == 0)
+			return;
+		// Carrier sense: start at once only if the bus has been quiet
+		// for the settling time of the frame
+		if(txWait <= DALITimeSinceLastEdge())
 		{
-			DALIProcessSendData(txData[txDataR]);
-			txDataR = (txDataR + 1) % TX_QUEUE_SIZE;
+			DALIStartTxData();
 		}
-		return 1;
+		else
+		{
+			DALIEnterPreIdle();
+		}
+	}
+	else if(daliState == PRE_IDLE)
+	{
+		// The new frame may have a higher priority than the one the
+		// current deadline was computed for
+		DALISchedulePreIdle();
 	}
 }
+
 void DALIProcessSendData(struct DALITxData txdata)
 {
+	txRecovery = 0;
 	DALIFlags.sendTwiceFrame = txdata.sendTwice;
 	DALIFlags.txFrameType = txdata.frameType;
 	DALIFlags.txError = 0;
@@ -973,11 +1078,133 @@ void DALIProcessSendData(struct DALITxData txdata)
 	}
 	halfBitNumber = 1;
 	daliState = SEND_DATA;
-	writePin(TX_Pin, DALI_LO);
-	reset_timer(&htim2);
-	set_timer_reload_val(TE, &htim2);
-	enable_timer_int(&htim2);
+	dali_tx_write(DALI_LO);
+	tim2_reset();
+	tim2_set_reload(TE);
+	tim2_enable_int();
+
+}
+
+uint32_t DALISelectTxData(void)
+{
+	uint8_t i, best, prev, priority, bestPriority;
+	struct DALITxData temp;
+	bestPriority = 6;
+	if(txDataR != txDataW)
+	{
+		best = txDataR;
+		for(i = txDataR; i != txDataW; i = (i + 1) % TX_QUEUE_SIZE)
+		{
+			priority = DALITxPriority(&txData[i]);
+			if(priority < bestPriority)
+			{
+				best = i;
+				bestPriority = priority;
+			}
+		}
+		// Shift the frames queued before the selected one back by one slot
+		temp = txData[best];
+		while(best != txDataR)
+		{
+			prev = (best == 0) ? (TX_QUEUE_SIZE - 1) : (best - 1);
+			txData[best] = txData[prev];
+			best = prev;
+		}
+		txData[txDataR] = temp;
+	}
+	// The frame that collided was queued first and wins a tie. A backward frame queued since
+	// goes before it, it would otherwise miss the reply window
+	txFromRetry = (txRetryPending != 0) && (DALITxPriority(&txRetry) <= bestPriority);
+	if(txFromRetry != 0)
+	{
+		bestPriority = DALITxPriority(&txRetry);
+		if(txRecovery != 0)
+		{
+			// Retransmission after a collision
+			return TE_STOP_CONDITION + txRecovery;
+		}
+	}
+	else if(bestPriority > 5)
+	{
+		return 0;
+	}
+	return TE_STOP_CONDITION + txWaitFFMin[bestPriority] + (txJitter % (txWaitFFMax[bestPriority] - txWaitFFMin[bestPriority]));
+}
+
+uint8_t DALITxPriority(struct DALITxData const *data)
+{
+	uint8_t priority = (data->frameType == 1) ? 0 : data->priority;
+	if(priority > 5)
+	{
+		priority = 5;
+	}
+	return priority;
+}
+
+uint32_t DALITimeSinceLastEdge(void)
+{
+	uint32_t elapsed = get_time_base() - lastEdgeTime;
+	// Anything longer than all settling times is as good as forever
+	if(elapsed > (TE_TX_WAIT_FF_MAX / TIME_BASE_SCALE))
+	{
+		elapsed = TE_TX_WAIT_FF_MAX / TIME_BASE_SCALE;
+	}
+	return elapsed * TIME_BASE_SCALE;
+}
+
+void DALIStartTxData(void)
+{
+	if(dali_rx_read() == DALI_LO)
+	{
+		// Someone else has just started a frame or the cable is disconnected.
+		// Count it as bus activity and wait again.
+		lastEdgeTime = get_time_base();
+		DALIEnterPreIdle();
+		return;
+	}
+	if(txFromRetry != 0)
+	{
+		txCurrent = txRetry;
+		txRetryPending = 0;
+		txFromRetry = 0;
+	}
+	else
+	{
+		txCurrent = txData[txDataR];
+		txDataR = (txDataR + 1) % TX_QUEUE_SIZE;
+	}
+	DALIProcessSendData(txCurrent);
+}
 
+void DALIRetryTxData(void)
+{
+	txRetry = txCurrent;
+	txRetryPending = 1;
+}
+
+void DALIEnterPreIdle(void)
+{
+	txJitter = rand();
+	daliState = PRE_IDLE;
+	DALISchedulePreIdle();
+	tim2_enable_int();
+}
+
+void DALISchedulePreIdle(void)
+{
+	uint32_t wait = DALISelectTxData();
+	uint32_t elapsed = DALITimeSinceLastEdge();
+	if(wait == 0)
+	{
+		wait = TE_STOP_CONDITION + TE_TX_WAIT_FF5_MAX;
+	}
+	wait = (wait > elapsed) ? (wait - elapsed) : 0;
+	if(wait < TE)
+	{
+		wait = TE;
+	}
+	// The timer keeps counting, program the deadline relative to its current value
+	tim2_set_reload(tim2_get_count() + wait);
 }
 
 uint8_t DALIDataAvailable(void)
@@ -991,6 +1218,11 @@ struct DALIRxData DALIReceiveData(void)
     return rxData[rxDataR-1];
 }
 
+uint32_t DALIReceiveTime(void)
+{
+	return rxQueueTime[rxDataR];
+}
+
 uint8_t DALIReceiveDataFlags(void)
 {
     return flagsData[rxDataR].flagsByte;
@@ -1006,6 +1238,41 @@ uint8_t DALIReadState(void)
     return daliState;
 }
 
+uint8_t DALITxDone(void)
+{
+	// Waiting for a backward frame after a forward frame of this device counts as done, events get none
+	if((txDataR != txDataW) || (txRetryPending != 0) || (txSubmitted != 0))
+		return 0;
+	return (daliState == IDLE) || (daliState == PRE_IDLE) || (daliState == WAIT_FOR_BACKFRAME);
+}
+
+uint8_t DALIStopAllowed(void)
+{
+	if((daliState != IDLE) || (txDataR != txDataW) || (txRetryPending != 0) || (txSubmitted != 0) || (rxDataR != rxDataW) || (rxEdgeR != rxEdgeW))
+		return 0;
+	return DALITimeSinceLastEdge() >= TE_TX_WAIT_FF_MAX;
+}
+
+uint8_t DALIStopWake(void)
+{
+	// Woken by the falling edge of a start bit, its ISR has not run yet
+	if((daliState == IDLE) && (__HAL_GPIO_EXTI_GET_IT(RX_Pin) != 0) && (dali_rx_read() == DALI_LO))
+	{
+		tim2_set_count(TE_STOP_WAKE);
+		rxWakeEdge = 1;
+		return 1;
+	}
+	return 0;
+}
+
+uint8_t DALIBusQuiet(uint32_t settle)
+{
+	// Every other state is a frame in progress or a reply that may still come
+	if((daliState != IDLE) && (daliState != PRE_IDLE))
+		return 0;
+	return DALITimeSinceLastEdge() >= settle;
+}
+
 void DALIClearFlags(void)
 {
     uint8_t a;
@@ -1040,9 +1307,12 @@ void DALIAppendToQueue(void)
 	        rxData[rxDataW].rxDone				= DALIFlags.rxDone;
 	        rxData[rxDataW].rxError				= DALIFlags.rxError;
 	        rxData[rxDataW].rxSendTwicePossible = DALIFlags.rxSendTwicePossible;
+	        rxQueueTime[rxDataW]				= get_time_base();
 
 	        // Advance writing head on the circular buffer
 	        rxDataW = (rxDataW + 1) % RX_QUEUE_SIZE;
+	        // The frame is processed in PendSV as soon as the bus interrupts are done
+	        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 	    }
 	}
     // Clear machine flags such that the next frame will not inherit garbage.
@@ -8,10 +8,15 @@
 
 #include "dali.h"
 #include "dali_application.h"
+#include "dali_input.h"
+#include "dali_filter.h"
+#include "dali_calibration.h"
+#include "adc.h"
 
 #define BLANK_8  0xFF
 #define BLANK_16 0xFFFF
 #define BLANK_32 0xFFFFFFFF
+#define EVENT_QUEUE_SIZE 8
 
 // Device variables
 uint32_t 	searchAddress 						= 0xFFFFFF; // range from 0 to 0xFFFFFF
@@ -34,44 +39,41 @@ uint16_t 	applicationActive;
 uint16_t 	applicationControllerPresent;
 uint16_t 	applicationControllerAlwaysActive;
 uint16_t 	powerCycleNotification;
-uint16_t 	eventPriority;// range from 2 to 5
 uint16_t	versionNumber;	// 2.1
 uint16_t 	extendedVersionNumber;
 uint8_t 	deviceCapabilities					= 0;
 uint8_t		deviceStatus						= 0;
 
 // Instance variables
-uint16_t	inputValue;	// maximum = (2^(N*8)-1) where N = round(resolution/8)
-uint8_t		instanceError		= FALSE;
-uint16_t 	instanceGroup0;
-uint16_t 	instanceGroup1;
-uint16_t 	instanceGroup2;
-uint16_t 	instanceActive;
-uint16_t	resolution;	// should be 10
-uint16_t	eventFilter;
-uint16_t	instanceNumber;
-uint16_t	instanceType;
-uint16_t	eventScheme;
+DALIInstances_t	instances;
+volatile uint32_t instancePending	= 0;
+const uint8_t	instanceTypeDefault[]	= INSTANCE_TYPES;
+// Discrete events raised by the input drivers, sent in the order they happened
+struct
+{
+	uint8_t		instance;
+	uint16_t	eventInfo;
+} eventQueue[EVENT_QUEUE_SIZE];
+volatile uint8_t eventQueueW = 0;
+volatile uint8_t eventQueueR = 0;
 
 // Input device only variables
 uint8_t		instanceErrorByte		= 0;
-uint32_t	hysteresisBand			= 0;
-uint32_t	hysteresisBandHigh		= 0;
-uint32_t	hysteresisBandLow		= 0;
-uint16_t	tReport;
-uint16_t 	tDeadtime;
-uint16_t 	hysteresisMin			= 10;
-uint16_t 	hysteresis				= 5;
-uint16_t	id_time					= 0;
 uint8_t 	isSecondFrame			= 0;
 uint8_t		debug=0;
 
-volatile uint8_t quiescent_time;
-volatile uint8_t initialise_time;
-volatile uint16_t report_time;
-volatile uint16_t dead_time;
-volatile uint16_t powerNoti_time = 0;
+soft_timer_t quiescentTimer;
+soft_timer_t initialiseTimer;
+soft_timer_t identifyTimer;
+soft_timer_t powerNotiTimer;
 volatile uint8_t powerNoti_flag = 0;
+volatile uint8_t dispatchLock = 0;
+volatile uint8_t dispatchDeferred = 0;
+volatile uint8_t saveDeferred = 0;			// NVM save asked for by the main loop, done by the dispatcher
+// Flash byte of an answered memory write. The flash stalls the core, it is written once the answer is out
+volatile uint8_t memoryWritePending = 0;
+uint8_t memoryWriteBank, memoryWriteOffset, memoryWriteData;
+volatile uint8_t conversionPending = 0;
 
 // Private variables
 uint32_t 	previousFrame;
@@ -81,11 +83,33 @@ uint16_t 	illuminance = 0;
 uint32_t	fullFrame = 0;
 uint8_t		backFrame = 0;
 uint16_t 	inputValue_10b = 0;
+uint8_t		answerSent = FALSE;
+uint8_t		saveRequired = FALSE;
+// inputValue_10b = 1000*adcVal/conversionDivisor[s] for light sensor s with the multiplier conversionMul[s],
+// clamped from conversionLimit[s] on, see DALI_Update_Conversion
+uint32_t	conversionMul[LIGHT_SENSORS] = {0};
+uint32_t	conversionDivisor[LIGHT_SENSORS] = {0};
+uint32_t	conversionLimit[LIGHT_SENSORS] = {0};
+// Linearisation table of memory bank 190, used for the first light sensor instead of the two-point calibration when it holds points
+uint8_t		linearisationCount = 0;
+int32_t		linearisationSlope[LINEARISATION_MAX_POINTS];	// Output counts per input count of each segment, 16 fraction bits
 // Private functions
 void DALI_Reset_Variables();
 void DALI_Save_Variable();
+void DALI_Send_Answer(uint8_t value);
+void DALI_Check_EventScheme(uint8_t instance);
+void DALI_Request_Save(void);
+void DALI_Defer_MemoryWrite(uint8_t memory_bank_number, uint8_t memory_offset, uint8_t data);
+void DALI_Flush_MemoryWrite(void);
+void DALI_Instance_DeadtimeExpired(soft_timer_t *timer);
+void DALI_Quiescent_Expired(soft_timer_t *timer);
+void DALI_Initialise_Expired(soft_timer_t *timer);
+void DALI_Identify_Expired(soft_timer_t *timer);
+void DALI_PowerNoti_Expired(soft_timer_t *timer);
 void DALI_Send_PowerCycleEvent();
 void DALI_Check_ResetState();
+void DALI_Load_Linearisation();
+uint16_t DALI_Linearise(uint32_t adcVal);
 
 void DALI_AppInit()
 {
@@ -112,11 +136,9 @@ void DALI_AppInit()
 		applicationActive_NVM = FALSE;
 	if(powerCycleNotification_NVM == BLANK_16)
 		powerCycleNotification_NVM = DISABLED;
-	if(eventPriority_NVM == BLANK_16)
-		eventPriority_NVM = 4;
 
 	if(numberOfInstances_NVM == BLANK_16)
-		numberOfInstances_NVM = 1;
+		numberOfInstances_NVM = sizeof(instanceTypeDefault);
 	if(applicationControllerPresent_NVM == BLANK_16)
 		applicationControllerPresent_NVM = FALSE;
 	if(applicationControllerAlwaysActive_NVM == BLANK_16)
@@ -125,34 +147,41 @@ void DALI_AppInit()
 		versionNumber_NVM = 9;
 	if(extendedVersionNumber_NVM == BLANK_16)
 		extendedVersionNumber_NVM = 8;
-	if(instanceGroup0_NVM == BLANK_16)
-		instanceGroup0_NVM = BLANK_8;
-	if(instanceGroup1_NVM == BLANK_16)
-		instanceGroup1_NVM = BLANK_8;
-	if(instanceGroup2_NVM == BLANK_16)
-		instanceGroup2_NVM = BLANK_8;
-	if(instanceActive_NVM == BLANK_16)
-		instanceActive_NVM = TRUE;
-	if(eventFilter_NVM == BLANK_16)
-		eventFilter_NVM = 1;
-	if(eventScheme_NVM == BLANK_16)
-		eventScheme_NVM = 0;
+	for(uint8_t i = 0; i < MAX_INSTANCES; i++)
+	{
+		// The type comes first, the defaults of the other variables depend on it
+		uint8_t type = (i < sizeof(instanceTypeDefault)) ? instanceTypeDefault[i] : GENERIC_INSTANCE;
+		if(instanceType_NVM(i) == BLANK_16)
+			instanceType_NVM(i) = type;
+		if(instanceGroup0_NVM(i) == BLANK_16)
+			instanceGroup0_NVM(i) = BLANK_8;
+		if(instanceGroup1_NVM(i) == BLANK_16)
+			instanceGroup1_NVM(i) = BLANK_8;
+		if(instanceGroup2_NVM(i) == BLANK_16)
+			instanceGroup2_NVM(i) = BLANK_8;
+		if(instanceActive_NVM(i) == BLANK_16)
+			instanceActive_NVM(i) = TRUE;
+		if(eventFilter_NVM(i) == BLANK_16)
+			eventFilter_NVM(i) = DALI_Input_DefaultEventFilter(type);
+		if(eventScheme_NVM(i) == BLANK_16)
+			eventScheme_NVM(i) = 0;
+		if(eventPriority_NVM(i) == BLANK_16)
+			eventPriority_NVM(i) = DALI_Input_DefaultEventPriority(type);
 
-	if(instanceType_NVM == BLANK_16)
-		instanceType_NVM = 4;
-	if(resolution_NVM == BLANK_16)
-		resolution_NVM = 10;
-	if(instanceNumber_NVM == BLANK_16)
-		instanceNumber_NVM = 1;
+		if(resolution_NVM(i) == BLANK_16)
+			resolution_NVM(i) = DALI_Input_DefaultResolution(type);
+		if(instanceNumber_NVM(i) == BLANK_16)
+			instanceNumber_NVM(i) = i;
 
-	if(tReport_NVM == BLANK_16)
-		tReport_NVM = 30;
-	if(tDeadtime_NVM == BLANK_16)
-		tDeadtime_NVM = 30;
-	if(hysteresisMin_NVM == BLANK_16)
-		hysteresisMin_NVM = 10;
-	if(hysteresis_NVM == BLANK_16)
-		hysteresis_NVM = 5;
+		if(tReport_NVM(i) == BLANK_16)
+			tReport_NVM(i) = 30;
+		if(tDeadtime_NVM(i) == BLANK_16)
+			tDeadtime_NVM(i) = 30;
+		if(hysteresisMin_NVM(i) == BLANK_16)
+			hysteresisMin_NVM(i) = 10;
+		if(hysteresis_NVM(i) == BLANK_16)
+			hysteresis_NVM(i) = 5;
+	}
 	dali_NVM_lock();
 
 	// Set power on value
@@ -160,36 +189,128 @@ void DALI_AppInit()
 	deviceGroups 							= deviceGroups_NVM;
 	searchAddress 							= 0xFFFFFF;
 	randomAddress 							= randomAddress_NVM;
-	numberOfInstances				 		= numberOfInstances_NVM;
+	// The instances are those of this build. The ROM cells are written only while blank and
+	// keep the count and types of the build that first started the device
+	numberOfInstances				 		= sizeof(instanceTypeDefault);
 	operatingMode 							= operatingMode_NVM;
 	applicationActive 						= applicationActive_NVM;
 	applicationControllerPresent 			= applicationControllerPresent_NVM;
 	applicationControllerAlwaysActive 		= applicationControllerAlwaysActive_NVM;
 	powerCycleNotification 					= powerCycleNotification_NVM;
-	eventPriority 							= eventPriority_NVM;
 	versionNumber 							= versionNumber_NVM;
-	instanceGroup0 							= instanceGroup0_NVM;
-	instanceGroup1 							= instanceGroup1_NVM;
-	instanceGroup2 							= instanceGroup2_NVM;
-	instanceActive 							= instanceActive_NVM;
-	instanceType 							= instanceType_NVM;
-	resolution 								= resolution_NVM;
-	instanceNumber 							= instanceNumber_NVM;
-	eventFilter 							= eventFilter_NVM;
-	eventScheme 							= eventScheme_NVM;
-	quiescent_time 							= 0;
-	initialise_time 						= 0;
-	tReport									= tReport_NVM;
-	tDeadtime								= tDeadtime_NVM;
-	hysteresisMin							= hysteresisMin_NVM;
-	hysteresis								= hysteresis_NVM;
+	soft_timer_stop(&quiescentTimer);
+	soft_timer_stop(&initialiseTimer);
+	for(uint8_t i = 0; i < MAX_INSTANCES; i++)
+	{
+		instances.inputValue[i]				= 0;
+		instances.instanceError[i]			= FALSE;
+		instances.instanceGroup0[i] 		= instanceGroup0_NVM(i);
+		instances.instanceGroup1[i] 		= instanceGroup1_NVM(i);
+		instances.instanceGroup2[i] 		= instanceGroup2_NVM(i);
+		instances.instanceActive[i] 		= instanceActive_NVM(i);
+		instances.instanceType[i] 			= (i < sizeof(instanceTypeDefault)) ? instanceTypeDefault[i] : GENERIC_INSTANCE;
+		instances.resolution[i] 			= resolution_NVM(i);
+		instances.instanceNumber[i] 		= instanceNumber_NVM(i);
+		instances.eventFilter[i] 			= eventFilter_NVM(i);
+		instances.eventScheme[i] 			= eventScheme_NVM(i);
+		instances.eventPriority[i] 			= eventPriority_NVM(i);
+		instances.tReport[i]				= tReport_NVM(i);
+		instances.tDeadtime[i]				= tDeadtime_NVM(i);
+		instances.hysteresisMin[i]			= hysteresisMin_NVM(i);
+		instances.hysteresis[i]				= hysteresis_NVM(i);
+		instances.hysteresisMul[i]			= HYSTERESIS_MUL(instances.hysteresis[i]);
+		instances.hysteresisBandHigh[i]		= 0;
+		instances.hysteresisBandLow[i]		= 0;
+		soft_timer_stop(&instances.reportTimer[i]);
+		soft_timer_stop(&instances.deadTimer[i]);
+	}
+	DALI_Update_Conversion();
+	DALI_Input_Init();
 	if(powerCycleNotification == ENABLED)
 	{
-		powerNoti_time = 1200;
+		soft_timer_start(&powerNotiTimer, 1200, DALI_PowerNoti_Expired);
 	}
 	DALIConfigureMode(applicationActive);
 }
 
+void DALI_Dispatch(void)
+{
+	// The main loop is changing application state, it hands the frames back when it is done
+	if(dispatchLock != 0)
+	{
+		dispatchDeferred = 1;
+		return;
+	}
+	// The flash writes of the main loop are done here so that they cannot interleave with those of the commands
+	if(saveDeferred != 0)
+	{
+		saveDeferred = 0;
+		DALI_Save_Variable();
+	}
+	DALI_Calibration_Commit();
+	// The end of every transmission pends the dispatch, the answer of a memory write is out once TX is done
+	if(DALITxDone())
+	{
+		DALI_Flush_MemoryWrite();
+	}
+	while(DALIDataAvailable())
+	{
+		// A frame that came first is processed after the write, a read must see the new byte
+		DALI_Flush_MemoryWrite();
+		uint32_t received = DALIReceiveTime();
+		DALI_ProcessRxData();
+		// Longest time from the end of a frame to its answer being queued, in us
+		uint32_t latency = (get_time_base() - received) >> 1;
+		if(latency > 0xFFFF)
+			latency = 0xFFFF;
+		uint32_t longest = memory_bank_191[dispatchLatency_addr] | ((uint32_t)memory_bank_191[dispatchLatency_addr + 1] << 8);
+		if(latency > longest)
+		{
+			memory_bank_191[dispatchLatency_addr] = latency & 0xFF;
+			memory_bank_191[dispatchLatency_addr + 1] = latency >> 8;
+		}
+	}
+}
+
+void DALI_Dispatch_Lock(void)
+{
+	dispatchLock = 1;
+}
+
+void DALI_Dispatch_Unlock(void)
+{
+	dispatchLock = 0;
+	if(dispatchDeferred != 0)
+	{
+		dispatchDeferred = 0;
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	}
+}
+
+void DALI_Request_Save(void)
+{
+	saveDeferred = 1;
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+void DALI_Defer_MemoryWrite(uint8_t memory_bank_number, uint8_t memory_offset, uint8_t data)
+{
+	DALI_Flush_MemoryWrite();
+	memoryWriteBank = memory_bank_number;
+	memoryWriteOffset = memory_offset;
+	memoryWriteData = data;
+	memoryWritePending = 1;
+}
+
+void DALI_Flush_MemoryWrite(void)
+{
+	if(memoryWritePending == 0)
+		return;
+	memoryWritePending = 0;
+	memory_write(memoryWriteBank, memoryWriteOffset, memoryWriteData);
+	conversionPending = 1;
+}
+
 void DALI_ProcessRxData()
 {
 	uint32_t frame;
@@ -274,7 +395,7 @@ void DALI_ProcessRxData()
 							if(cmd->opcode_byte == 0)
 							{
 								initialisationState = DISABLED;
-								initialise_time = 0;
+								soft_timer_stop(&initialiseTimer);
 							}
 							break;
 						case INITIALISE:
@@ -289,7 +410,7 @@ void DALI_ProcessRxData()
 									if(((cmd->opcode_byte == 0x7F) && (shortAddress == 0xFF)) || (cmd->opcode_byte == 0xFF) || ((cmd->opcode_byte < 64) && (cmd->opcode_byte == shortAddress)))
 									{
 										initialisationState = ENABLED;
-										initialise_time = 15; // 15 min
+										soft_timer_start(&initialiseTimer, 15*60000UL, DALI_Initialise_Expired); // 15 min
 									}
 								}
 								isSecondFrame = 1;
@@ -374,11 +495,11 @@ void DALI_ProcessRxData()
 								{
 									DALITxData_t data = {cmd->opcode_byte, 1, 0, 1};
 									DALISendData(data);
-									HAL_Delay(20);
+									// The flash write would stall the core while the answer goes out, staged and RAM bytes are done
 									if(error == 2)
-										memory_write(DTR1, DTR0, cmd->opcode_byte);
+										DALI_Defer_MemoryWrite(DTR1, DTR0, cmd->opcode_byte);
 								}
-								if((DTR0 < 0xFF) && (DTR1 == 189))
+								if((DTR0 < 0xFF) && MANUFACTURER_BANK(DTR1))
 									DTR0++;
 							}
 							break;
@@ -388,8 +509,11 @@ void DALI_ProcessRxData()
 							{
 								uint8_t error = dali_memory_write(DTR1, DTR0, cmd->opcode_byte);
 								if(error == 2)
+								{
 									memory_write(DTR1, DTR0, cmd->opcode_byte);
-								if((DTR0 < 0xFF) && (DTR1 == 189))
+									conversionPending = 1;
+								}
+								if((DTR0 < 0xFF) && MANUFACTURER_BANK(DTR1))
 									DTR0++;
 							}
 							break;
@@ -447,11 +571,11 @@ void DALI_ProcessRxData()
 							{
 								DALITxData_t data = {cmd->opcode_byte, 1, 0, 1};
 								DALISendData(data);
-								HAL_Delay(20);
+								// The flash write would stall the core while the answer goes out, staged and RAM bytes are done
 								if(error == 2)
-									memory_write(DTR1, DTR0, cmd->opcode_byte);
+									DALI_Defer_MemoryWrite(DTR1, DTR0, cmd->opcode_byte);
 							}
-							if((DTR0 < 0xFF) && (DTR1 == 189))
+							if((DTR0 < 0xFF) && MANUFACTURER_BANK(DTR1))
 								DTR0++;
 						}
 						previousFrame = frame;
@@ -487,7 +611,7 @@ void DALI_ProcessRxData()
 							else
 							{
 								writePin(LED_Pin, 0);
-								id_time = 10000;
+								soft_timer_start(&identifyTimer, 10000, DALI_Identify_Expired);
 								isSecondFrame = 1;
 							}
 							break;
@@ -521,6 +645,7 @@ void DALI_ProcessRxData()
 							break;
 						case RESET_MEMORY_BANK:
 							dali_memory_reset(DTR0);
+							conversionPending = 1;
 							break;
 						case SET_SHORT_ADDRESS:
 							if(frame != previousFrame)
@@ -687,7 +812,7 @@ void DALI_ProcessRxData()
 								if(msg_ptr->rxSendTwicePossible == 1)
 								{
 									quiescentMode = ENABLED;
-									quiescent_time = 15; // 15 min
+									soft_timer_start(&quiescentTimer, 15*60000UL, DALI_Quiescent_Expired); // 15 min
 								}
 								isSecondFrame = 1;
 							}
@@ -702,7 +827,8 @@ void DALI_ProcessRxData()
 								if(msg_ptr->rxSendTwicePossible == 1)
 								{
 									quiescentMode = DISABLED;
-									quiescent_time = 0;
+									soft_timer_stop(&quiescentTimer);
+									DALI_Instance_MarkAll();
 								}
 								isSecondFrame = 1;
 							}
@@ -851,11 +977,18 @@ void DALI_ProcessRxData()
 						case QUERY_APPLICATION_CONTROLLER_ERROR:
 							break;
 						case QUERY_INPUT_DEVICE_ERROR:
-							if(instanceError != 0)
+						{
+							uint8_t error = FALSE;
+							for(uint8_t i = 0; i < numberOfInstances; i++)
 							{
-								DALITxData_t data = {instanceError, 1, 0, 1};
+								error |= instances.instanceError[i];
+							}
+							if(error != 0)
+							{
+								DALITxData_t data = {error, 1, 0, 1};
 								DALISendData(data);
 							}
+						}
 							break;
 						case QUERY_MISSING_SHORT_ADDRESS:
 							if (shortAddress == 0xFF)
@@ -919,6 +1052,14 @@ void DALI_ProcessRxData()
 							break;
 						case READ_MEMORY_LOCATION:;
 						{
+							// The scope window streams the capture, DTR0 wraps within the window while the block moves on
+							if((DTR1 == SCOPE_BANK) && (DTR0 >= scopeWindow_addr))
+							{
+								DALITxData_t data = {dali_memory_scope_read(DTR0), 1, 0, 1};
+								DALISendData(data);
+								DTR0 = (DTR0 == 0xFF) ? scopeWindow_addr : (DTR0 + 1);
+								break;
+							}
 							memory_read_t read = dali_memory_read(DTR1, DTR0);
 							if(read.success == 1)
 							{
@@ -929,7 +1070,7 @@ void DALI_ProcessRxData()
 							}
 							else
 							{
-								if((DTR1 == 0) || (DTR1 == 189))
+								if((DTR1 == 0) || MANUFACTURER_BANK(DTR1))
 									DTR0++;
 							}
 						}
@@ -1025,10 +1166,14 @@ void DALI_ProcessRxData()
 								{
 									if((DTR0 > 1) && (DTR0 < 6))
 									{
-										eventPriority = DTR0;
+										// Device command, applies to every instance
+										for(uint8_t i = 0; i < numberOfInstances; i++)
+										{
+											instances.eventPriority[i] = DTR0;
+											if(DTR0 != DALI_Input_DefaultEventPriority(instances.instanceType[i]))
+												resetState = FALSE;
+										}
 										DALI_Save_Variable();
-										if(eventPriority != 4)
-											resetState = FALSE;
 									}
 								}
 								isSecondFrame = 1;
@@ -1036,7 +1181,7 @@ void DALI_ProcessRxData()
 							break;
 						case QUERY_EVENT_PRIORITY:
 						{
-							DALITxData_t data = {eventPriority, 1, 0, 1};
+							DALITxData_t data = {instances.eventPriority[0], 1, 0, 1};
 							DALISendData(data);
 						}
 							break;
@@ -1049,370 +1194,368 @@ void DALI_ProcessRxData()
 							break;
 						}
 					}
-					else if((cmd->instance_byte == 0xFF) || (cmd->instance_byte == instanceNumber) || (cmd->instance_byte == 0xC0 + instanceType) 	\
-							|| ((instanceGroup0 < 0xFF) && (cmd->instance_byte == instanceGroup0 + 0x80))			\
-							|| ((instanceGroup1 < 0xFF) && (cmd->instance_byte == instanceGroup2 + 0x80))			\
-							|| ((instanceGroup2 < 0xFF) && (cmd->instance_byte == instanceGroup1 + 0x80)))			\
-					// Instance command
+					else // Instance command
 					{
-						switch(cmd->opcode_byte)
+						answerSent = FALSE;
+						saveRequired = FALSE;
+						for(uint8_t i = 0; i < numberOfInstances; i++)
 						{
-						case ENABLE_INSTANCE:
-							if(frame != previousFrame)
+							if(DALI_Instance_Match(i, cmd->instance_byte) == FALSE)
 							{
-								DALIReceiveTwice();
+								continue;
 							}
-							else
+							switch(cmd->opcode_byte)
 							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+							case ENABLE_INSTANCE:
+								if(frame != previousFrame)
 								{
-									instanceActive = TRUE;
-									DALI_Save_Variable();
+									DALIReceiveTwice();
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case DISABLE_INSTANCE:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								else
 								{
-									instanceActive = FALSE;
-									DALI_Save_Variable();
+									if(msg_ptr->rxSendTwicePossible == 1)
+									{
+										instances.instanceActive[i] = TRUE;
+										// The input interrupts and the software timers mark instances too
+										uint32_t primask = __get_PRIMASK();
+										__disable_irq();
+										instancePending |= (1UL << i);
+										__set_PRIMASK(primask);
+										saveRequired = TRUE;
+									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_PRIMARY_INSTANCE_GROUP:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case DISABLE_INSTANCE:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
 								{
-									if((DTR0 < 32) || (DTR0 == 0xFF))
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										instanceGroup0 = DTR0;
-										DALI_Save_Variable();
-										if(instanceGroup0 != 0xFF)
-											resetState = FALSE;
+										instances.instanceActive[i] = FALSE;
+										saveRequired = TRUE;
 									}
-
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_INSTANCE_GROUP_1:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case SET_PRIMARY_INSTANCE_GROUP:
+								if(frame != previousFrame)
 								{
-									if((DTR0 < 32) || (DTR0 == 0xFF))
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										instanceGroup1 = DTR0;
-										DALI_Save_Variable();
-										if(instanceGroup1 != 0xFF)
-											resetState = FALSE;
+										if((DTR0 < 32) || (DTR0 == 0xFF))
+										{
+											instances.instanceGroup0[i] = DTR0;
+											saveRequired = TRUE;
+											if(instances.instanceGroup0[i] != 0xFF)
+												resetState = FALSE;
+										}
+
 									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_INSTANCE_GROUP_2:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case SET_INSTANCE_GROUP_1:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
 								{
-									if((DTR0 < 32) || (DTR0 == 0xFF))
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										instanceGroup2 = DTR0;
-										DALI_Save_Variable();
-										if(instanceGroup2 != 0xFF)
-											resetState = FALSE;
+										if((DTR0 < 32) || (DTR0 == 0xFF))
+										{
+											instances.instanceGroup1[i] = DTR0;
+											saveRequired = TRUE;
+											if(instances.instanceGroup1[i] != 0xFF)
+												resetState = FALSE;
+										}
 									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_EVENT_PRIORITY:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case SET_INSTANCE_GROUP_2:
+								if(frame != previousFrame)
 								{
-									if((DTR0 > 1) && (DTR0 < 6))
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										eventPriority = DTR0;
-										DALI_Save_Variable();
-										if(eventPriority != 4)
-											resetState = FALSE;
+										if((DTR0 < 32) || (DTR0 == 0xFF))
+										{
+											instances.instanceGroup2[i] = DTR0;
+											saveRequired = TRUE;
+											if(instances.instanceGroup2[i] != 0xFF)
+												resetState = FALSE;
+										}
 									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_EVENT_SCHEME:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case SET_EVENT_PRIORITY:
+								if(frame != previousFrame)
 								{
-									if(DTR0 < 5)
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										eventScheme = DTR0;
-										DALI_Save_Variable();
-										if(eventScheme != 0)
-											resetState = FALSE;
+										if((DTR0 > 1) && (DTR0 < 6))
+										{
+											instances.eventPriority[i] = DTR0;
+											saveRequired = TRUE;
+											if(instances.eventPriority[i] != DALI_Input_DefaultEventPriority(instances.instanceType[i]))
+												resetState = FALSE;
+										}
 									}
-
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_EVENT_FILTER:
-							if(frame != previousFrame)
-							{
-								DALIReceiveTwice();
-							}
-							else
-							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								break;
+							case SET_EVENT_SCHEME:
+								if(frame != previousFrame)
 								{
-									if(applicationActive)
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										eventFilter = (DTR2 << 16) | (DTR1 << 8) | DTR0;
-										DALI_Save_Variable();
-										if(eventFilter != 0xFFFFFF)
-											resetState = FALSE;
+										if(DTR0 < 5)
+										{
+											instances.eventScheme[i] = DTR0;
+											saveRequired = TRUE;
+											if(instances.eventScheme[i] != 0)
+												resetState = FALSE;
+										}
+
 									}
-									else
+									isSecondFrame = 1;
+								}
+								break;
+							case SET_EVENT_FILTER:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										if(DTR0 < 2)
+										if(applicationActive)
 										{
-											eventFilter = DTR0;
-											DALI_Save_Variable();
+											instances.eventFilter[i] = (DTR2 << 16) | (DTR1 << 8) | DTR0;
+											saveRequired = TRUE;
+											if(instances.eventFilter[i] != DALI_Input_DefaultEventFilter(instances.instanceType[i]))
+												resetState = FALSE;
+										}
+										else
+										{
+											if(DTR0 < 2)
+											{
+												instances.eventFilter[i] = DTR0;
+												saveRequired = TRUE;
+											}
+											if(instances.eventFilter[i] != 1)
+												resetState = FALSE;
 										}
-										if(eventFilter != 1)
-											resetState = FALSE;
 									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
+								break;
+							case QUERY_INSTANCE_TYPE:
+							{
+								DALI_Send_Answer(instances.instanceType[i]);
 							}
-							break;
-						case QUERY_INSTANCE_TYPE:
-						{
-							DALITxData_t data = {instanceType, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_RESOLUTION:
-						{
-							DALITxData_t data = {resolution, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INSTANCE_STATUS:;
-						{
-							uint8_t temp = (instanceError << 7) | (instanceActive << 6);
-							DALITxData_t data = {temp, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INSTANCE_ENABLED:
-							if(instanceActive == TRUE)
+								break;
+							case QUERY_RESOLUTION:
 							{
-								DALITxData_t data = {0xFF, 1, 0, 1};
-								DALISendData(data);
+								DALI_Send_Answer(instances.resolution[i]);
 							}
-							break;
-						case QUERY_PRIMARY_INSTANCE_GROUP:;
-						{
-							DALITxData_t data = {instanceGroup0, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INSTANCE_GROUP_1:;
-						{
-							DALITxData_t data = {instanceGroup1, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INSTANCE_GROUP_2:;
-						{
-							DALITxData_t data = {instanceGroup2, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_EVENT_SCHEME:;
-						{
-							DALITxData_t data = {eventScheme, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INPUT_VALUE:
-						{
-							inputValue_latch = inputValue;
-							inputValue_byte = (resolution + 7)/8 - 1;
-							DALITxData_t data = {(inputValue_latch >> (inputValue_byte*8)) & 0xFF, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INPUT_VALUE_LATCH:
-							if(inputValue_byte != 0)
+								break;
+							case QUERY_INSTANCE_STATUS:;
 							{
-								inputValue_byte--;
-								DALITxData_t data = {(inputValue_latch >> (inputValue_byte*8)) & 0xFF, 1, 0, 1};
-								DALISendData(data);
+								uint8_t temp = (instances.instanceError[i] << 7) | (instances.instanceActive[i] << 6);
+								DALI_Send_Answer(temp);
 							}
-							break;
-						case QUERY_EVENT_PRIORITY:;
-						{
-							DALITxData_t data = {eventPriority, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_FEATURE_TYPE:
-							break;
-						case QUERY_NEXT_FEATURE_TYPE:
-							break;
-						case QUERY_EVENT_FILTER_0_7:;
-						{
-							DALITxData_t data = {eventFilter & 0xFF, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_EVENT_FILTER_8_15:;
-						{
-							DALITxData_t data = {(eventFilter >> 8) & 0xFF, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_EVENT_FILTER_16_23:
-						{
-							DALITxData_t data = {(eventFilter >> 16) & 0xFF, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case SET_REPORT_TIMER:
-							if(frame != previousFrame)
+								break;
+							case QUERY_INSTANCE_ENABLED:
+								if(instances.instanceActive[i] == TRUE)
+								{
+									DALI_Send_Answer(0xFF);
+								}
+								break;
+							case QUERY_PRIMARY_INSTANCE_GROUP:;
 							{
-								DALIReceiveTwice();
+								DALI_Send_Answer(instances.instanceGroup0[i]);
 							}
-							else
+								break;
+							case QUERY_INSTANCE_GROUP_1:;
 							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								DALI_Send_Answer(instances.instanceGroup1[i]);
+							}
+								break;
+							case QUERY_INSTANCE_GROUP_2:;
+							{
+								DALI_Send_Answer(instances.instanceGroup2[i]);
+							}
+								break;
+							case QUERY_EVENT_SCHEME:;
+							{
+								DALI_Send_Answer(instances.eventScheme[i]);
+							}
+								break;
+							case QUERY_INPUT_VALUE:
+								// Only the instance that answers latches its value
+								if(answerSent == FALSE)
 								{
-									tReport = DTR0;
-									if(tReport != 30)
-										resetState = FALSE;
+									inputValue_latch = instances.inputValue[i];
+									inputValue_byte = (instances.resolution[i] + 7)/8 - 1;
+									DALI_Send_Answer((inputValue_latch >> (inputValue_byte*8)) & 0xFF);
 								}
-								isSecondFrame = 1;
+								break;
+							case QUERY_INPUT_VALUE_LATCH:
+								if((answerSent == FALSE) && (inputValue_byte != 0))
+								{
+									inputValue_byte--;
+									DALI_Send_Answer((inputValue_latch >> (inputValue_byte*8)) & 0xFF);
+								}
+								break;
+							case QUERY_EVENT_PRIORITY:;
+							{
+								DALI_Send_Answer(instances.eventPriority[i]);
 							}
-							break;
-						case SET_HYSTERESIS:
-							if(frame != previousFrame)
+								break;
+							case QUERY_FEATURE_TYPE:
+								break;
+							case QUERY_NEXT_FEATURE_TYPE:
+								break;
+							case QUERY_EVENT_FILTER_0_7:;
 							{
-								DALIReceiveTwice();
+								DALI_Send_Answer(instances.eventFilter[i] & 0xFF);
 							}
-							else
+								break;
+							case QUERY_EVENT_FILTER_8_15:;
 							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								DALI_Send_Answer((instances.eventFilter[i] >> 8) & 0xFF);
+							}
+								break;
+							case QUERY_EVENT_FILTER_16_23:
+							{
+								DALI_Send_Answer((instances.eventFilter[i] >> 16) & 0xFF);
+							}
+								break;
+							case SET_REPORT_TIMER:
+								if(frame != previousFrame)
 								{
-									if(DTR0 <= 25)
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
 									{
-										hysteresis = DTR0;
-										if(hysteresis != 5)
+										instances.tReport[i] = DTR0;
+										if(instances.tReport[i] != 30)
 											resetState = FALSE;
 									}
+									isSecondFrame = 1;
 								}
-								isSecondFrame = 1;
-							}
-							break;
-						case SET_DEADTIME_TIMER:
-							if(frame != previousFrame)
+								break;
+							case SET_HYSTERESIS:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
+									{
+										if(DTR0 <= 25)
+										{
+											instances.hysteresis[i] = DTR0;
+											instances.hysteresisMul[i] = HYSTERESIS_MUL(DTR0);
+											if(instances.hysteresis[i] != 5)
+												resetState = FALSE;
+										}
+									}
+									isSecondFrame = 1;
+								}
+								break;
+							case SET_DEADTIME_TIMER:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
+									{
+										instances.tDeadtime[i] = DTR0;
+										if(instances.tDeadtime[i] != 30)
+											resetState = FALSE;
+									}
+									isSecondFrame = 1;
+								}
+								break;
+							case SET_HYSTERESIS_MIN:
+								if(frame != previousFrame)
+								{
+									DALIReceiveTwice();
+								}
+								else
+								{
+									if(msg_ptr->rxSendTwicePossible == 1)
+									{
+										instances.hysteresisMin[i] = DTR0;
+										if(instances.hysteresisMin[i] != 10)
+											resetState = FALSE;
+									}
+									isSecondFrame = 1;
+								}
+								break;
+							case QUERY_DEADTIME_TIMER:
 							{
-								DALIReceiveTwice();
+								DALI_Send_Answer(instances.tDeadtime[i]);
 							}
-							else
+								break;
+							case QUERY_INSTANCE_ERROR:
 							{
-								if(msg_ptr->rxSendTwicePossible == 1)
+								if(instances.instanceError[i] != 0)
 								{
-									tDeadtime = DTR0;
-									if(tDeadtime != 30)
-										resetState = FALSE;
+									DALI_Send_Answer(instances.instanceError[i]);
 								}
-								isSecondFrame = 1;
 							}
-							break;
-						case SET_HYSTERESIS_MIN:
-							if(frame != previousFrame)
+								break;
+							case QUERY_REPORT_TIMER:
 							{
-								DALIReceiveTwice();
+								DALI_Send_Answer(instances.tReport[i]);
 							}
-							else
+								break;
+							case QUERY_HYSTERESIS:
 							{
-								if(msg_ptr->rxSendTwicePossible == 1)
-								{
-									hysteresisMin = DTR0;
-									if(hysteresisMin != 10)
-										resetState = FALSE;
-								}
-								isSecondFrame = 1;
+								DALI_Send_Answer(instances.hysteresis[i]);
 							}
-							break;
-						case QUERY_DEADTIME_TIMER:
-						{
-							DALITxData_t data = {tDeadtime, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_INSTANCE_ERROR:
-						{
-							if(instanceError != 0)
+								break;
+							case QUERY_HYSTERESIS_MIN:
 							{
-								DALITxData_t data = {instanceError, 1, 0, 1};
-								DALISendData(data);
+								DALI_Send_Answer(instances.hysteresisMin[i]);
+							}
+								break;
 							}
 						}
-							break;
-						case QUERY_REPORT_TIMER:
-						{
-							DALITxData_t data = {tReport, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_HYSTERESIS:
-						{
-							DALITxData_t data = {hysteresis, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
-						case QUERY_HYSTERESIS_MIN:
+						if(saveRequired)
 						{
-							DALITxData_t data = {hysteresisMin, 1, 0, 1};
-							DALISendData(data);
-						}
-							break;
+							DALI_Save_Variable();
 						}
 					}
 					if(memory_related == 0)
@@ -1437,70 +1580,229 @@ void DALI_ProcessRxData()
 
 void DALI_SendEvent()
 {
-	if((applicationActive == FALSE) && (quiescentMode == FALSE) && (dead_time == 0) && (eventFilter % 2 == 1) && (instanceActive == TRUE) && (instanceError == FALSE))
+	uint32_t pending;
+	// Frames are built under the dispatch lock and sent once it is released
+	DALITxData_t frames[EVENT_QUEUE_SIZE + MAX_INSTANCES];
+	uint8_t count = 0;
+	// Take the pending instances atomically, timer ticks may add new ones meanwhile
+	__disable_irq();
+	pending = instancePending;
+	instancePending = 0;
+	__enable_irq();
+
+	DALI_Dispatch_Lock();
+	// Periodic reports of the event driven instances join their queued events
+	for(uint8_t i = 0; i < numberOfInstances; i++)
 	{
-		if ((((eventScheme == 1) || (eventScheme == 2)) && (shortAddress == 0xFF)) \
-				|| ((eventScheme == 3) && (deviceGroups == 0)) || ((eventScheme == 4) && (instanceGroup0 == 0xFF)))
+		if((pending & (1UL << i)) && DALI_Input_IsEventDriven(instances.instanceType[i]))
 		{
-			eventScheme = 0;
-			DALI_Save_Variable();
+			DALI_Input_Report(i);
 		}
+	}
 
-		uint32_t frame;
-		switch(eventScheme)
+	// Events are dropped, not delayed, while they are not allowed
+	while(eventQueueR != eventQueueW)
+	{
+		uint8_t i = eventQueue[eventQueueR].instance;
+		uint16_t eventInfo = eventQueue[eventQueueR].eventInfo;
+		if(count >= EVENT_QUEUE_SIZE)
 		{
-		case 0:
-			frame = 0x800000 | ((instanceType << 17) & 0x3E0000) | 0x8000 | ((instanceNumber << 10) & 0x7C00) | ((inputValue >> 6) & 0x3FF);
-			break;
-		case 1:
-			frame = ((shortAddress << 17) & 0x7E0000) | ((instanceType << 10) & 0x7C00) | ((inputValue >> 6) & 0x3FF);
-			break;
-		case 2:
-			frame = ((shortAddress << 17) & 0x7E0000) | 0x8000 | ((instanceNumber << 10) & 0x7C00) | ((inputValue >> 6) & 0x3FF);
-			break;
-		case 3:;
-			uint32_t temp = deviceGroups;
-			uint8_t count = 1;
-			// Find the lowest device group number of membership of the containing device
-			while(temp % 2 == 0)
-			{
-				temp = temp >> 1;
-				count++;
-			}
-			frame = 0x800000 | ((count << 17) & 0x3E0000) | ((instanceType << 10) & 0x7C00) | ((inputValue >> 6) & 0x3FF);
-			break;
-		case 4:
-			frame = 0xC00000 | ((instanceGroup0 << 17) & 0x3E0000) | ((instanceType << 10) & 0x7C00) | ((inputValue >> 6) & 0x3FF);
+			// Events raised meanwhile filled the frames, they are sent on the next call
+			__disable_irq();
+			instancePending |= (1UL << i);
+			__enable_irq();
 			break;
 		}
+		eventQueueR = (eventQueueR + 1) % EVENT_QUEUE_SIZE;
+		if((applicationActive == FALSE) && (quiescentMode == DISABLED) && (instances.instanceActive[i] == TRUE) && (instances.instanceError[i] == FALSE))
+		{
+			DALI_Check_EventScheme(i);
+			DALITxData_t data = {DALI_Build_EventFrame(i, eventInfo), 0, 0, instances.eventPriority[i]};
+			frames[count++] = data;
+		}
+	}
 
-		if((inputValue > hysteresisBandHigh) || (inputValue < hysteresisBandLow))
+	for(uint8_t i = 0; (pending != 0) && (i < numberOfInstances) && (applicationActive == FALSE) && (quiescentMode == DISABLED); i++, pending >>= 1)
+	{
+		// Instances of the event driven types only send the events they raise
+		if(((pending & 1) == 0) || DALI_Input_IsEventDriven(instances.instanceType[i]))
+		{
+			continue;
+		}
+		if(soft_timer_running(&instances.deadTimer[i]) || (instances.eventFilter[i] % 2 == 0) \
+				|| (instances.instanceActive[i] == FALSE) || (instances.instanceError[i] == TRUE))
 		{
-			DALITxData_t data = {frame, 0, 0, 4};
-			DALISendData(data);
-			hysteresisBand = (hysteresisMin > (hysteresis * inputValue / 100)) ? hysteresisMin : (hysteresis * inputValue / 100);
+			continue;
+		}
+		DALI_Check_EventScheme(i);
 
-			if(inputValue > hysteresisBandHigh)
-			{
-				hysteresisBandHigh = inputValue;
-				hysteresisBandLow = (inputValue > hysteresisBand)? (inputValue - hysteresisBand) : 0;
-			}
-			else
-			{
-				hysteresisBandLow = inputValue;
-				hysteresisBandHigh = inputValue + hysteresisBand;
-			}
-			report_time = tReport*1000;
-			dead_time = tDeadtime*50;
+		uint16_t inputValue = instances.inputValue[i];
+		DALITxData_t data = {DALI_Build_EventFrame(i, (inputValue >> 6) & 0x3FF), 0, 0, instances.eventPriority[i]};
+
+		if(DALI_Input_Hysteresis(i, inputValue))
+		{
+			frames[count++] = data;
+			DALI_Instance_RestartTimers(i);
 		}
-		else if((report_time == 0) && (tReport != 0))
+		else if(!soft_timer_running(&instances.reportTimer[i]) && (instances.tReport[i] != 0))
 		{
-			DALITxData_t data = {frame, 0, 0, 4};
-			DALISendData(data);
-			report_time = tReport*1000;
-			dead_time = tDeadtime*50;
+			frames[count++] = data;
+			DALI_Instance_RestartTimers(i);
 		}
 	}
+	DALI_Dispatch_Unlock();
+
+	for(uint8_t n = 0; n < count; n++)
+	{
+		DALISendData(frames[n]);
+	}
+}
+
+void DALI_Check_EventScheme(uint8_t instance)
+{
+	// Fall back to instance addressing when the addressing of the event scheme is not available
+	uint8_t eventScheme = instances.eventScheme[instance];
+	if ((((eventScheme == 1) || (eventScheme == 2)) && (shortAddress == 0xFF)) \
+			|| ((eventScheme == 3) && (deviceGroups == 0)) || ((eventScheme == 4) && (instances.instanceGroup0[instance] == 0xFF)))
+	{
+		instances.eventScheme[instance] = 0;
+		DALI_Request_Save();
+	}
+}
+
+uint32_t DALI_Build_EventFrame(uint8_t instance, uint16_t eventInfo)
+{
+	uint32_t frame = 0;
+	uint8_t instanceType = instances.instanceType[instance];
+	uint8_t instanceNumber = instances.instanceNumber[instance];
+	switch(instances.eventScheme[instance])
+	{
+	case 0:
+		frame = 0x800000 | ((instanceType << 17) & 0x3E0000) | 0x8000 | ((instanceNumber << 10) & 0x7C00) | (eventInfo & 0x3FF);
+		break;
+	case 1:
+		frame = ((shortAddress << 17) & 0x7E0000) | ((instanceType << 10) & 0x7C00) | (eventInfo & 0x3FF);
+		break;
+	case 2:
+		frame = ((shortAddress << 17) & 0x7E0000) | 0x8000 | ((instanceNumber << 10) & 0x7C00) | (eventInfo & 0x3FF);
+		break;
+	case 3:;
+		uint32_t temp = deviceGroups;
+		uint8_t count = 1;
+		// Find the lowest device group number of membership of the containing device
+		while(temp % 2 == 0)
+		{
+			temp = temp >> 1;
+			count++;
+		}
+		frame = 0x800000 | ((count << 17) & 0x3E0000) | ((instanceType << 10) & 0x7C00) | (eventInfo & 0x3FF);
+		break;
+	case 4:
+		frame = 0xC00000 | ((instances.instanceGroup0[instance] << 17) & 0x3E0000) | ((instanceType << 10) & 0x7C00) | (eventInfo & 0x3FF);
+		break;
+	}
+	return frame;
+}
+
+void DALI_Instance_SetValue(uint8_t instance, uint16_t value)
+{
+	if(instances.inputValue[instance] != value)
+	{
+		instances.inputValue[instance] = value;
+		__disable_irq();
+		instancePending |= (1UL << instance);
+		__enable_irq();
+	}
+}
+
+void DALI_Instance_RaiseEvent(uint8_t instance, uint16_t eventInfo, uint32_t filter)
+{
+	if((instance >= numberOfInstances) || ((instances.eventFilter[instance] & filter) == 0))
+	{
+		return;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint8_t next = (eventQueueW + 1) % EVENT_QUEUE_SIZE;
+	if(next != eventQueueR)		// Event is lost when the queue is full
+	{
+		eventQueue[eventQueueW].instance = instance;
+		eventQueue[eventQueueW].eventInfo = eventInfo;
+		eventQueueW = next;
+		instancePending |= (1UL << instance);
+	}
+	__set_PRIMASK(primask);
+}
+
+void DALI_Instance_MarkAll(void)
+{
+	instancePending = (numberOfInstances >= 32) ? 0xFFFFFFFF : ((1UL << numberOfInstances) - 1);
+}
+
+void DALI_Instance_RestartTimers(uint8_t instance)
+{
+	soft_timer_start(&instances.reportTimer[instance], instances.tReport[instance]*1000UL, DALI_Instance_ReportExpired);
+	soft_timer_start(&instances.deadTimer[instance], instances.tDeadtime[instance]*50UL, DALI_Instance_DeadtimeExpired);
+}
+
+void DALI_Instance_ReportExpired(soft_timer_t *timer)
+{
+	instancePending |= (1UL << (timer - instances.reportTimer));
+}
+
+void DALI_Instance_DeadtimeExpired(soft_timer_t *timer)
+{
+	// Value changes held back during the dead time are reported when it ends
+	instancePending |= (1UL << (timer - instances.deadTimer));
+}
+
+void DALI_Quiescent_Expired(soft_timer_t *timer)
+{
+	quiescentMode = DISABLED;
+	DALI_Instance_MarkAll();
+}
+
+void DALI_Initialise_Expired(soft_timer_t *timer)
+{
+	initialisationState = DISABLED;
+}
+
+void DALI_Identify_Expired(soft_timer_t *timer)
+{
+	writePin(LED_Pin, 1);
+}
+
+void DALI_PowerNoti_Expired(soft_timer_t *timer)
+{
+	powerNoti_flag = 1;
+}
+
+uint8_t DALI_Instance_Match(uint8_t instance, uint8_t instance_byte)
+{
+	if(instance_byte == 0xFF)	// Broadcast
+		return TRUE;
+	if(instance_byte < 0x20)	// Instance number
+		return (instance_byte == instances.instanceNumber[instance]);
+	if((instance_byte >= 0x80) && (instance_byte < 0xA0))	// Instance group
+	{
+		uint8_t group = instance_byte - 0x80;
+		return ((instances.instanceGroup0[instance] == group) || (instances.instanceGroup1[instance] == group) \
+				|| (instances.instanceGroup2[instance] == group));
+	}
+	if((instance_byte >= 0xC0) && (instance_byte < 0xE0))	// Instance type
+		return (instance_byte == 0xC0 + instances.instanceType[instance]);
+	return FALSE;
+}
+
+void DALI_Send_Answer(uint8_t value)
+{
+	// Several instances may be addressed by one query, only one backward frame is sent
+	if(answerSent == FALSE)
+	{
+		DALITxData_t data = {value, 1, 0, 1};
+		DALISendData(data);
+		answerSent = TRUE;
+	}
 }
 
 void DALI_Reset_Variables()
@@ -1512,41 +1814,48 @@ void DALI_Reset_Variables()
 	writeEnableState 	= DISABLED;
 	powerCycleSeen		= FALSE;
 	resetState			= TRUE;
-	instanceGroup0		= 0xFF;
-	instanceGroup1		= 0xFF;
-	instanceGroup2		= 0xFF;
-	eventPriority		= 4;
-	eventScheme			= 0;
-	if(applicationActive)
-	{
-		eventFilter = 0xFFFF;
-	}
-	else
+	for(uint8_t i = 0; i < numberOfInstances; i++)
 	{
-		eventFilter	= 1;
-		tReport		= 30;
-		tDeadtime 	= 30;
-		hysteresis 	= 5;
-		if (resolution <= 6)
-			hysteresisMin = 0;
-		else if(resolution == 7)
-			hysteresisMin = 1;
-		else if(resolution == 8)
-			hysteresisMin = 2;
-		else if(resolution == 9)
-			hysteresisMin = 5;
-		else if(resolution == 10)
-			hysteresisMin = 10;
-		else if(resolution == 11)
-			hysteresisMin = 20;
-		else if(resolution == 12)
-			hysteresisMin = 40;
-		else if(resolution == 13)
-			hysteresisMin = 81;
-		else if(resolution == 14)
-			hysteresisMin = 163;
-		else if(resolution >= 15)
-			hysteresisMin = 255;
+		instances.instanceGroup0[i]		= 0xFF;
+		instances.instanceGroup1[i]		= 0xFF;
+		instances.instanceGroup2[i]		= 0xFF;
+		instances.eventPriority[i]		= DALI_Input_DefaultEventPriority(instances.instanceType[i]);
+		instances.eventScheme[i]		= 0;
+		if(applicationActive)
+		{
+			instances.eventFilter[i] = 0xFFFF;
+		}
+		else
+		{
+			uint8_t resolution = instances.resolution[i];
+			uint8_t hysteresisMin;
+			instances.eventFilter[i]	= DALI_Input_DefaultEventFilter(instances.instanceType[i]);
+			instances.tReport[i]		= 30;
+			instances.tDeadtime[i] 		= 30;
+			instances.hysteresis[i] 	= 5;
+			instances.hysteresisMul[i]	= HYSTERESIS_MUL(5);
+			if (resolution <= 6)
+				hysteresisMin = 0;
+			else if(resolution == 7)
+				hysteresisMin = 1;
+			else if(resolution == 8)
+				hysteresisMin = 2;
+			else if(resolution == 9)
+				hysteresisMin = 5;
+			else if(resolution == 10)
+				hysteresisMin = 10;
+			else if(resolution == 11)
+				hysteresisMin = 20;
+			else if(resolution == 12)
+				hysteresisMin = 40;
+			else if(resolution == 13)
+				hysteresisMin = 81;
+			else if(resolution == 14)
+				hysteresisMin = 163;
+			else
+				hysteresisMin = 255;
+			instances.hysteresisMin[i] 	= hysteresisMin;
+		}
 	}
 	DALI_Save_Variable();
 }
@@ -1563,36 +1872,151 @@ void DALI_Save_Variable()
 	operatingMode_NVM = operatingMode;
 	applicationActive_NVM = applicationActive;
 	powerCycleNotification_NVM = powerCycleNotification;
-	eventPriority_NVM = eventPriority;
-	instanceGroup0_NVM = instanceGroup0;
-	instanceGroup1_NVM = instanceGroup1;
-	instanceGroup2_NVM = instanceGroup2;
-	instanceActive_NVM = instanceActive;
-	eventFilter_NVM = eventFilter;
-	eventScheme_NVM = eventScheme;
-	tReport_NVM = tReport;
-	tDeadtime_NVM = tDeadtime;
-	hysteresisMin_NVM = hysteresisMin;
-	hysteresis_NVM = hysteresis;
+	for(uint8_t i = 0; i < MAX_INSTANCES; i++)
+	{
+		instanceGroup0_NVM(i) = instances.instanceGroup0[i];
+		instanceGroup1_NVM(i) = instances.instanceGroup1[i];
+		instanceGroup2_NVM(i) = instances.instanceGroup2[i];
+		instanceActive_NVM(i) = instances.instanceActive[i];
+		eventFilter_NVM(i) = instances.eventFilter[i];
+		eventScheme_NVM(i) = instances.eventScheme[i];
+		eventPriority_NVM(i) = instances.eventPriority[i];
+		tReport_NVM(i) = instances.tReport[i];
+		tDeadtime_NVM(i) = instances.tDeadtime[i];
+		hysteresisMin_NVM(i) = instances.hysteresisMin[i];
+		hysteresis_NVM(i) = instances.hysteresis[i];
+	}
 	dali_NVM_lock();
 }
 
-void DALI_Set_inputValue(uint32_t adcVal)
+void DALI_Set_inputValue(uint8_t instance, uint32_t adcVal)
 {
 	/*
 	 * fullScaleRange is a pre-defined value from manufacturer.
 	 * At calibration stage, calibrationOffset is recorded at 0 illuminance
-	 * and 16*calibrationScale is recorded at fullScaleRange illuminance
-	 * The inputValue is converted so that it equals 1000 at fullScaleRange illuminace (i.e when adcVal = 16*calibrationScale)
-	 * and it equals 0 at 0 illuminance (i.e when adcVal = calibrationOffset)
+	 * and 16*calibrationScale is recorded at fullScaleRange illuminance, both in 12-bit counts
+	 * adcVal is the sum of 16 oversampled 12-bit conversions, i.e. 16 times a 12-bit count
+	 * The inputValue is converted so that it equals 1000 at fullScaleRange illuminace (i.e when adcVal = 16*16*calibrationScale)
+	 * and it equals 0 at 0 illuminance (i.e when adcVal = 16*calibrationOffset)
+	 * 1000*adcVal/(16*(16*calibrationScale - calibrationOffset)) is done with the multiplier from DALI_Update_Conversion
+	 * Each light sensor instance has its own calibration bytes, see sensorScale and sensorOffset
+	 * A linearisation table in memory bank 190 replaces this two-point conversion for the first sensor
+	 */
+	uint8_t s = LIGHT_SENSOR(instance);
+	uint32_t value;
+	if((s == 0) && (linearisationCount != 0))
+	{
+		value = DALI_Linearise(adcVal);
+	}
+	else
+	{
+		uint32_t offset = 16*sensorOffset(s);
+		adcVal = (adcVal > offset) ? (adcVal - offset) : 0;
+		// Convert from 16-bit resolution to 0-1000 scale, past the limit the result is clamped anyway
+		if(adcVal >= conversionLimit[s])
+			value = 0x3FF;
+		else
+			value = fixed_ratio(adcVal, 1000, conversionDivisor[s], conversionMul[s], CONVERSION_SHIFT);
+	}
+	if(value > 0x3FF)
+		value = 0x3FF;
+	inputValue_10b = value;
+	DALI_Instance_SetValue(instance, (inputValue_10b << 6) | (inputValue_10b >> 4)); // MSB-aligned, the unused bits repeat the MSBs of the result
+}
+
+uint8_t DALI_Get_adcWindow(uint8_t instance, uint16_t *low, uint16_t *high)
+{
+	uint8_t s = LIGHT_SENSOR(instance);
+	int32_t span = 16*sensorScale(s) - sensorOffset(s);	// 12-bit counts from 0 to 1000
+	if(((s == 0) && (linearisationCount != 0)) || (span <= 0) || (instances.hysteresisBandHigh[instance] == 0))
+		return FALSE;
+	// The band is MSB-aligned, its top 10 bits are on the 0-1000 scale.
+	// Round inwards so that a value leaving the band always wakes the device up
+	uint32_t bandLow = instances.hysteresisBandLow[instance] >> 6;
+	uint32_t bandHigh = instances.hysteresisBandHigh[instance] >> 6;
+	uint32_t adcLow = sensorOffset(s) + (bandLow*span + 999)/1000;
+	uint32_t adcHigh = sensorOffset(s) + (bandHigh*span)/1000;
+	*low = (adcLow > 0xFFF) ? 0xFFF : adcLow;
+	*high = (adcHigh > 0xFFF) ? 0xFFF : adcHigh;
+	return TRUE;
+}
+
+void DALI_Update_Conversion(void)
+{
+	/*
+	 * Division by d = 16*(16*sensorScale - sensorOffset) becomes the fixed_ratio of conversionMul, one set per
+	 * light sensor. Results from 1024 on are clamped to 0x3FF, so adcVal is only multiplied below conversionLimit
+	 * which keeps adcVal*conversionMul in 32 bits for the smallest d.
+	 * A scale at or below the offset gives 0, like the division did: no multiplier and the largest divisor.
 	 */
-	inputValue_10b = 1000*(adcVal - calibrationOffset)/(16*calibrationScale - calibrationOffset);	// Convert from 12-bit resolution to 0-1000 scale
-	inputValue = ((inputValue_10b << 10) & 0xFC00) | (inputValue_10b & 0x3FF); // MSB-aligned, unused bits conatain a repeating pattern of MSB of the result
+	DALI_Load_Linearisation();
+	adc_compensation_configure(compensationControl, darkTemperatureCoeff);
+	for(uint8_t s = 0; s < LIGHT_SENSORS; s++)
+	{
+		DALI_Filter_Configure(&illuminanceFilter[s]);
+		int32_t divisor = 16*(16*sensorScale(s) - sensorOffset(s));
+		if(divisor <= 0)
+		{
+			conversionMul[s] = 0;
+			conversionDivisor[s] = 0xFFFFFFFF;
+			conversionLimit[s] = 0xFFFFFFFF;
+			continue;
+		}
+		conversionMul[s] = fixed_ratio_mul(1000, divisor, CONVERSION_SHIFT);
+		conversionDivisor[s] = divisor;
+		conversionLimit[s] = fixed_ratio_limit(1000, divisor, 0x3FF + 1);
+	}
+}
+
+void DALI_Load_Linearisation()
+{
+	// The table is used when it has 2 or more points with rising inputs and 10-bit outputs
+	linearisationCount = 0;
+	uint8_t count = linearisationPoints;
+	if((count < 2) || (count > LINEARISATION_MAX_POINTS))
+		return;
+	for(uint8_t k = 0; k < count; k++)
+	{
+		if((linearisationOutput(k) > 0x3FF) || ((k > 0) && (linearisationInput(k) <= linearisationInput(k - 1))))
+			return;
+	}
+	// Slopes are divided out here so that the sample path only multiplies
+	for(uint8_t k = 0; k < count - 1; k++)
+	{
+		int32_t rise = (int32_t)linearisationOutput(k + 1) - linearisationOutput(k);
+		int32_t run = linearisationInput(k + 1) - linearisationInput(k);
+		linearisationSlope[k] = (rise * 65536) / run;
+	}
+	linearisationCount = count;
+}
+
+uint16_t DALI_Linearise(uint32_t adcVal)
+{
+	uint8_t last = linearisationCount - 1;
+	if(adcVal <= linearisationInput(0))
+		return linearisationOutput(0);
+	if(adcVal >= linearisationInput(last))
+		return linearisationOutput(last);
+	// Binary search for the segment with input(low) <= adcVal < input(high)
+	uint8_t low = 0;
+	uint8_t high = last;
+	while(high - low > 1)
+	{
+		uint8_t mid = (low + high) >> 1;
+		if(adcVal < linearisationInput(mid))
+			high = mid;
+		else
+			low = mid;
+	}
+	int32_t step = ((int64_t)(adcVal - linearisationInput(low)) * linearisationSlope[low]) >> 16;
+	return linearisationOutput(low) + step;
 }
 
  void DALI_Send_PowerCycleEvent()
  {
 	 uint32_t frame = 0xFEE000;
+	 // Addressing of the frame, which the commands may be changing
+	 DALI_Dispatch_Lock();
 	 if (deviceGroups > 0)
 	 {
 		 frame = frame | (1 << 12);
@@ -1611,6 +2035,7 @@ void DALI_Set_inputValue(uint32_t adcVal)
 		 frame = frame | (1 << 6);
 		 frame = frame | (shortAddress & 0x1F);
 	 }
+	 DALI_Dispatch_Unlock();
 	 DALITxData_t data = {frame, 0, 0, 3};
 	 DALISendData(data);
  }
@@ -1619,11 +2044,19 @@ void DALI_Set_inputValue(uint32_t adcVal)
  {
 	 if(resetState != TRUE)
 	 {
-		 if((deviceGroups != 0) || (searchAddress != 0xFFFFFF) || (instanceGroup0 != 0xFF) || (instanceGroup1 != 0xFF) || (instanceGroup2 != 0xFF) || \
-				 (eventFilter != 1) || (eventScheme != 0) || (eventPriority != 4) || (tReport != 30) || (tDeadtime != 30) || (hysteresisMin != 10) || (hysteresis != 5))
+		 if((deviceGroups != 0) || (searchAddress != 0xFFFFFF))
 		 {
 			 return;
 		 }
+		 for(uint8_t i = 0; i < numberOfInstances; i++)
+		 {
+			 if((instances.instanceGroup0[i] != 0xFF) || (instances.instanceGroup1[i] != 0xFF) || (instances.instanceGroup2[i] != 0xFF) || \
+					 (instances.eventFilter[i] != DALI_Input_DefaultEventFilter(instances.instanceType[i])) || (instances.eventScheme[i] != 0) || (instances.eventPriority[i] != DALI_Input_DefaultEventPriority(instances.instanceType[i])) || (instances.tReport[i] != 30) || \
+					 (instances.tDeadtime[i] != 30) || (instances.hysteresisMin[i] != 10) || (instances.hysteresis[i] != 5))
+			 {
+				 return;
+			 }
+		 }
 		 resetState = TRUE;
 	 }
  }
@@ -0,0 +1,122 @@
+/*
+ * dali_calibration.c
+ * This file implements the in-field calibration of the light sensors. A write to
+ * calibrateDark or calibrateFullScale in memory bank 189 starts a capture, the
+ * result is stored in the calibration offset or scale of each light sensor
+ */
+
+#include "main.h"
+#include "dali_calibration.h"
+#include "dali_memory.h"
+#include "dali_application.h"
+
+DALICalibration_t calibration = {CALIBRATION_WAIT, 0, 0, {0}, 0, {0}, {0}};
+uint8_t calibrationStatus[2] = {CALIBRATION_IDLE, CALIBRATION_IDLE};
+
+// Private functions
+void DALI_Calibration_Finish(void);
+
+void DALI_Calibration_Update(uint16_t const *samples, uint8_t sensors, volatile uint8_t *error)
+{
+	// The dispatcher has not written the last result yet
+	if(calibration.commit != 0)
+		return;
+	if(calibration.state == CALIBRATION_WAIT)
+	{
+		// Dark first, a full scale request waits for it
+		if(darkCalibrate == 1)
+		{
+			darkCalibrate = 0;
+			calibration.state = CALIBRATION_DARK;
+		}
+		else if(fullScaleCalibrate == 1)
+		{
+			fullScaleCalibrate = 0;
+			calibration.state = CALIBRATION_FULL_SCALE;
+		}
+		else
+		{
+			return;
+		}
+		calibration.count = 0;
+		calibration.sensors = (sensors > LIGHT_SENSORS) ? LIGHT_SENSORS : sensors;
+		for(uint8_t s = 0; s < LIGHT_SENSORS; s++)
+			calibration.sum[s] = 0;
+		// Only an error during this capture fails it
+		*error = 0;
+		// The result in hand may be older than the request, the capture starts with the next one
+		return;
+	}
+	if(*error)
+	{
+		calibrationStatus[calibration.state - CALIBRATION_DARK] = CALIBRATION_ERROR;
+		calibration.state = CALIBRATION_WAIT;
+		return;
+	}
+	for(uint8_t s = 0; s < calibration.sensors; s++)
+		calibration.sum[s] += samples[s];
+	calibration.count++;
+	if(calibration.count >= CALIBRATION_SAMPLES)
+	{
+		DALI_Calibration_Finish();
+	}
+}
+
+void DALI_Calibration_Finish(void)
+{
+	uint8_t status = CALIBRATION_DONE;
+	uint8_t *address = calibration.address;
+	uint8_t *value = calibration.value;
+	// All sensors are checked first so that a failing one leaves every calibration untouched
+	for(uint8_t s = 0; s < calibration.sensors; s++)
+	{
+		// Each result is the sum of 16 conversions, the mean 12-bit count keeps 4 fraction bits
+		uint32_t mean_q4 = calibration.sum[s] >> CALIBRATION_SAMPLES_SHIFT;
+		if(calibration.state == CALIBRATION_DARK)
+		{
+			// The offset is the dark level in 12-bit counts
+			uint32_t offset = (mean_q4 + 8) >> 4;
+			if((offset > 0xFF) || (offset >= 16*sensorScale(s)))
+				status = CALIBRATION_ERROR;
+			address[s] = sensorOffset_addr(s);
+			value[s] = offset;
+		}
+		else
+		{
+			// 16*scale is the full scale level in 12-bit counts
+			uint32_t scale = (mean_q4 + 128) >> 8;
+			if(scale > 0xFF)
+				scale = 0xFF;
+			if(((mean_q4 >> 4) >= CALIBRATION_SATURATION) || (16*scale <= sensorOffset(s)))
+				status = CALIBRATION_ERROR;
+			address[s] = sensorScale_addr(s);
+			value[s] = scale;
+		}
+	}
+	if(status == CALIBRATION_DONE)
+	{
+		// The flash write is handed to the dispatcher, the main loop goes on
+		calibration.commit = 1;
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+		return;
+	}
+	calibrationStatus[calibration.state - CALIBRATION_DARK] = status;
+	calibration.state = CALIBRATION_WAIT;
+}
+
+void DALI_Calibration_Commit(void)
+{
+	if(calibration.commit == 0)
+		return;
+	uint8_t status = CALIBRATION_DONE;
+	memory_write_bytes(189, calibration.sensors, calibration.address, calibration.value);
+	for(uint8_t s = 0; s < calibration.sensors; s++)
+	{
+		if((* (uint8_t*) (MEMORY_BANK_189_ADDR + calibration.address[s])) != calibration.value[s])	// Flash write failed
+			status = CALIBRATION_ERROR;
+	}
+	conversionPending = 1;
+	calibrationStatus[calibration.state - CALIBRATION_DARK] = status;
+	calibration.state = CALIBRATION_WAIT;
+	calibration.commit = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * dali_filter.c
+ * This file implements the filter stage between the light sensor acquisition
+ * and the event evaluation. The filter type and its coefficients are stored in
+ * memory bank 189
+ */
+
+#include "dali_filter.h"
+#include "dali_memory.h"
+#include "dali_input.h"
+
+DALIFilter_t illuminanceFilter[LIGHT_SENSORS];
+
+// Private functions
+uint16_t DALI_Filter_Median(DALIFilter_t *filter);
+
+void DALI_Filter_Configure(DALIFilter_t *filter)
+{
+	filter->type = filterType;
+	if(filter->type > FILTER_MEDIAN_IIR)
+		filter->type = FILTER_NONE;
+	filter->length = filterLength;
+	if(filter->length == 0)
+		filter->length = 1;
+	else if(filter->length > FILTER_MAX_LENGTH)
+		filter->length = FILTER_MAX_LENGTH;
+	filter->shift = filterShift;
+	if(filter->shift > FILTER_MAX_SHIFT)
+		filter->shift = FILTER_MAX_SHIFT;
+	// Cortex-M0 has no divider, the moving average keeps the largest power of 2 window within the length
+	filter->meanShift = 0;
+	while((2U << filter->meanShift) <= filter->length)
+		filter->meanShift++;
+	if(filter->type == FILTER_MOVING_AVERAGE)
+		filter->length = 1U << filter->meanShift;
+	// The next sample fills the window and primes the IIR
+	filter->index = 0;
+	filter->count = 0;
+	filter->sum = 0;
+}
+
+uint16_t DALI_Filter_Update(DALIFilter_t *filter, uint16_t sample)
+{
+	if(filter->type == FILTER_NONE)
+	{
+		filter->output = sample;
+		return sample;
+	}
+	uint8_t first = (filter->count == 0);
+	if(first && (filter->type == FILTER_MOVING_AVERAGE))
+	{
+		// A restart fills the window with the first sample, the mean is always taken over the full window
+		for(uint8_t i = 0; i < filter->length; i++)
+			filter->window[i] = sample;
+		filter->sum = (uint32_t)sample << filter->meanShift;
+		filter->count = filter->length;
+	}
+	// Keep the last length samples and their sum
+	if(filter->count < filter->length)
+	{
+		filter->count++;
+	}
+	else
+	{
+		filter->sum -= filter->window[filter->index];
+	}
+	filter->window[filter->index] = sample;
+	filter->sum += sample;
+	filter->index++;
+	if(filter->index >= filter->length)
+		filter->index = 0;
+
+	uint16_t value = sample;
+	if(filter->type == FILTER_MOVING_AVERAGE)
+	{
+		value = filter->sum >> filter->meanShift;
+	}
+	else if((filter->type == FILTER_MEDIAN) || (filter->type == FILTER_MEDIAN_IIR))
+	{
+		value = DALI_Filter_Median(filter);
+	}
+
+	if((filter->type == FILTER_IIR) || (filter->type == FILTER_MEDIAN_IIR))
+	{
+		uint32_t x = (uint32_t)value << FILTER_IIR_FRACTION;
+		if(first)
+			filter->iir = x;
+		else if(x > filter->iir)
+			filter->iir += (x - filter->iir) >> filter->shift;
+		else
+			filter->iir -= (filter->iir - x) >> filter->shift;
+		value = filter->iir >> FILTER_IIR_FRACTION;
+	}
+	filter->output = value;
+	return value;
+}
+
+uint16_t DALI_Filter_Median(DALIFilter_t *filter)
+{
+	// Insertion sort of a copy, the window holds at most FILTER_MAX_LENGTH samples
+	uint16_t sorted[FILTER_MAX_LENGTH];
+	for(uint8_t i = 0; i < filter->count; i++)
+	{
+		uint16_t v = filter->window[i];
+		uint8_t j = i;
+		while((j > 0) && (sorted[j - 1] > v))
+		{
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = v;
+	}
+	return sorted[filter->count / 2];
+}
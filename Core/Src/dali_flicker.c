@@ -0,0 +1,188 @@
+/*
+ * dali_flicker.c
+ * This file implements the flicker analysis of the light sensor. A scope capture
+ * of the light sensor channel is taken periodically and reduced to percent flicker,
+ * flicker index and dominant frequency with Goertzel bins
+ */
+
+#include "dali_flicker.h"
+#include "dali_input.h"
+#include "adc.h"
+
+DALIFlicker_t flicker = {FLICKER_WAIT};
+
+// Private functions
+void DALI_Flicker_Statistics(void);
+void DALI_Flicker_Bin(void);
+void DALI_Flicker_Report(void);
+
+void DALI_Flicker_Init(void)
+{
+	soft_timer_start(&flicker.waitTimer, FLICKER_T_PERIOD, NULL);
+}
+
+uint8_t DALI_Flicker_Update(uint8_t result_index)
+{
+	switch(flicker.state)
+	{
+	case FLICKER_WAIT:
+		// Held off while bank 191 is unlocked, so that a manual capture is not overwritten during its readout
+		if(!soft_timer_running(&flicker.waitTimer) && (adc_scope_state != ADC_SCOPE_BUSY) && (lock_byte[SCOPE_BANK] != 0x55))
+		{
+			adc_scope_start(result_index, FLICKER_SAMPLE_PERIOD);
+			flicker.state = FLICKER_CAPTURE;
+		}
+		break;
+	case FLICKER_CAPTURE:
+		// The main loop restores the scans once the buffer is full
+		if(adc_scope_state == ADC_SCOPE_DONE)
+			flicker.state = FLICKER_STATISTICS;
+		else if(adc_scope_state != ADC_SCOPE_BUSY)
+			flicker.state = FLICKER_WAIT;
+		if(flicker.state == FLICKER_WAIT)
+			soft_timer_start(&flicker.waitTimer, FLICKER_T_PERIOD, NULL);
+		break;
+	case FLICKER_STATISTICS:
+		DALI_Flicker_Statistics();
+		break;
+	case FLICKER_BINS:
+		// A new capture replaced the samples, start over
+		if(adc_scope_state == ADC_SCOPE_BUSY)
+		{
+			flicker.state = FLICKER_WAIT;
+			soft_timer_start(&flicker.waitTimer, FLICKER_T_PERIOD, NULL);
+			break;
+		}
+		DALI_Flicker_Bin();
+		break;
+	}
+	return (flicker.state == FLICKER_STATISTICS) || (flicker.state == FLICKER_BINS);
+}
+
+void DALI_Flicker_Statistics(void)
+{
+	/*
+	 * Percent flicker = (max - min)/(max + min) and flicker index = area above the mean / total area,
+	 * both on the light level with the dark level removed. ADC_SCOPE_SAMPLES is a power of 2,
+	 * the mean is a shift and the two ratios are the only divisions of the analysis.
+	 */
+	uint32_t sum = 0;
+	uint16_t min = 0xFFFF;
+	uint16_t max = 0;
+	for(uint16_t n = 0; n < ADC_SCOPE_SAMPLES; n++)
+	{
+		uint16_t x = adc_scope_buffer[n];
+		sum += x;
+		if(x < min)
+			min = x;
+		if(x > max)
+			max = x;
+	}
+	flicker.mean = sum / ADC_SCOPE_SAMPLES;
+	uint32_t above = 0;
+	for(uint16_t n = 0; n < ADC_SCOPE_SAMPLES; n++)
+	{
+		if(adc_scope_buffer[n] > flicker.mean)
+			above += adc_scope_buffer[n] - flicker.mean;
+	}
+	uint32_t dark = calibrationOffset;
+	uint32_t light = (sum > ADC_SCOPE_SAMPLES*dark) ? (sum - ADC_SCOPE_SAMPLES*dark) : 0;
+	uint32_t high = (max > dark) ? (max - dark) : 0;
+	uint32_t low = (min > dark) ? (min - dark) : 0;
+	flicker.percent = (high == 0) ? 0 : (1000*(high - low)) / (high + low);
+	flicker.index = (light == 0) ? 0 : (uint32_t)((1000ULL*above) / light);
+	flicker.frequency = 0;
+	// A difference of a count or two is conversion noise, there is no frequency to look for
+	if((max - min) <= 2)
+	{
+		flicker.percent = 0;
+		flicker.index = 0;
+		DALI_Flicker_Report();
+		return;
+	}
+	// Scale the largest swing from the mean into FLICKER_INPUT_BITS, the mean lies within [min, max]
+	uint32_t mean = flicker.mean;
+	uint32_t swing = max - mean;
+	uint32_t below = mean - min;
+	if(below > swing)
+		swing = below;
+	flicker.shift = 0;
+	while((swing >> flicker.shift) >= (1UL << FLICKER_INPUT_BITS))
+		flicker.shift++;
+	// Step the bin coefficient up to the first bin, 2cos(0) = 2
+	flicker.cosPrevious = 2L << FLICKER_COS_FRACTION;
+	flicker.cosCurrent = FLICKER_COS_STEP;
+	for(uint16_t k = 1; k < FLICKER_BIN_MIN; k++)
+	{
+		int32_t next = (((int64_t)FLICKER_COS_STEP * flicker.cosCurrent) >> FLICKER_COS_FRACTION) - flicker.cosPrevious;
+		flicker.cosPrevious = flicker.cosCurrent;
+		flicker.cosCurrent = next;
+	}
+	flicker.bin = FLICKER_BIN_MIN;
+	flicker.peakPower = 0;
+	flicker.peakBin = 0;
+	flicker.state = FLICKER_BINS;
+}
+
+void DALI_Flicker_Bin(void)
+{
+	/*
+	 * Goertzel filter of one bin, s0 = x + coeff*s1 - s2 with coeff = 2cos(w).
+	 * The state grows as 1/sin(w), largest where coeff is close to +/-2. coeff*s1 is taken as
+	 * +/-(2*s1 - delta*s1) with delta = 2 -/+ coeff, delta*s1 stays in 32 bits for any bin.
+	 */
+	int32_t coeff = flicker.cosCurrent >> (FLICKER_COS_FRACTION - FLICKER_COEFF_FRACTION);
+	int32_t delta = (coeff >= 0) ? ((2L << FLICKER_COEFF_FRACTION) - coeff) : ((2L << FLICKER_COEFF_FRACTION) + coeff);
+	int32_t mean = flicker.mean;
+	uint8_t shift = flicker.shift;
+	int32_t s1 = 0;
+	int32_t s2 = 0;
+	if(coeff >= 0)
+	{
+		for(uint16_t n = 0; n < ADC_SCOPE_SAMPLES; n++)
+		{
+			int32_t s0 = (((int32_t)adc_scope_buffer[n] - mean) >> shift) + 2*s1 - ((delta * s1) >> FLICKER_COEFF_FRACTION) - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+	}
+	else
+	{
+		for(uint16_t n = 0; n < ADC_SCOPE_SAMPLES; n++)
+		{
+			int32_t s0 = (((int32_t)adc_scope_buffer[n] - mean) >> shift) - 2*s1 + ((delta * s1) >> FLICKER_COEFF_FRACTION) - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+	}
+	// |X|^2 = s1^2 + s2^2 - coeff*s1*s2
+	int64_t power = (int64_t)s1*s1 + (int64_t)s2*s2 - (((int64_t)coeff * s1) >> FLICKER_COEFF_FRACTION)*s2;
+	if((power > 0) && ((uint64_t)power > flicker.peakPower))
+	{
+		flicker.peakPower = power;
+		flicker.peakBin = flicker.bin;
+	}
+	int32_t next = (((int64_t)FLICKER_COS_STEP * flicker.cosCurrent) >> FLICKER_COS_FRACTION) - flicker.cosPrevious;
+	flicker.cosPrevious = flicker.cosCurrent;
+	flicker.cosCurrent = next;
+	flicker.bin++;
+	if(flicker.bin > FLICKER_BIN_MAX)
+	{
+		flicker.frequency = ((uint32_t)flicker.peakBin * FLICKER_SAMPLE_RATE) / ADC_SCOPE_SAMPLES;
+		DALI_Flicker_Report();
+	}
+}
+
+void DALI_Flicker_Report(void)
+{
+	uint16_t value = (flicker.percent > 0x3FF) ? 0x3FF : flicker.percent;
+	DALI_Dispatch_Lock();
+	DALI_Instance_SetValue(FLICKER_INSTANCE, (value << 6) | (value >> 4));	// MSB-aligned, the unused bits repeat the MSBs
+	memory_bank_191[flickerIndex_addr] = flicker.index & 0xFF;
+	memory_bank_191[flickerIndex_addr + 1] = flicker.index >> 8;
+	memory_bank_191[flickerFrequency_addr] = flicker.frequency & 0xFF;
+	memory_bank_191[flickerFrequency_addr + 1] = flicker.frequency >> 8;
+	DALI_Dispatch_Unlock();
+	flicker.state = FLICKER_WAIT;
+	soft_timer_start(&flicker.waitTimer, FLICKER_T_PERIOD, NULL);
+}
@@ -0,0 +1,297 @@
+/*
+ * dali_input.c
+ * This file implements the instance type drivers of DALI input devices.
+ * The drivers turn pin edges and samples into instance values and events
+ * for the application layer
+ */
+
+#include "dali_input.h"
+#include "gpio.h"
+
+DALIButton_t button = {BUTTON_RELEASED, FALSE, FALSE, {0, NULL, 0}, {0, NULL, 0}, 0};
+DALIOccupancy_t occupancy = {FALSE, FALSE, {0, NULL, 0}};
+DALIAbsoluteInput_t absoluteInput = {0, 0, ABSOLUTE_T_FAST, {0, NULL, 0}};
+volatile uint8_t absolute_flag = 0;
+
+// Private functions
+void DALI_Input_ButtonUpdate(uint8_t pressed);
+void DALI_Input_ButtonTimeout(soft_timer_t *timer);
+void DALI_Input_ButtonDebounced(soft_timer_t *timer);
+void DALI_Input_OccupancyEvent(uint16_t eventInfo, uint32_t filter);
+void DALI_Input_OccupancyVacant(soft_timer_t *timer);
+void DALI_Input_AbsoluteDue(soft_timer_t *timer);
+
+void DALI_Input_Init(void)
+{
+	// A button held at power up is taken as pressed without reporting it
+	if(readPin(BUTTON_Pin) == BUTTON_ACTIVE_LEVEL)
+	{
+		button.state = BUTTON_PRESSED;
+		soft_timer_start(&button.deadlineTimer, BUTTON_T_SHORT, DALI_Input_ButtonTimeout);
+		instances.inputValue[BUTTON_INSTANCE] = 0xFF;
+	}
+	instances.inputValue[OCCUPANCY_INSTANCE] = OCCUPANCY_VACANT_VALUE;
+	if(readPin(PIR_Pin) == PIR_ACTIVE_LEVEL)
+	{
+		DALI_Input_OccupancyIntHandler();
+	}
+	soft_timer_start(&absoluteInput.sampleTimer, absoluteInput.period, DALI_Input_AbsoluteDue);
+}
+
+void DALI_Input_ButtonIntHandler(void)
+{
+	// The first edge is taken at once, bounces after it are ignored
+	if(soft_timer_running(&button.debounceTimer))
+	{
+		return;
+	}
+	soft_timer_start(&button.debounceTimer, BUTTON_T_DEBOUNCE, DALI_Input_ButtonDebounced);
+	DALI_Input_ButtonUpdate(readPin(BUTTON_Pin) == BUTTON_ACTIVE_LEVEL);
+}
+
+void DALI_Input_ButtonDebounced(soft_timer_t *timer)
+{
+	// Pick up an edge that was ignored during the debounce time
+	DALI_Input_ButtonUpdate(readPin(BUTTON_Pin) == BUTTON_ACTIVE_LEVEL);
+}
+
+void DALI_Input_AbsoluteDue(soft_timer_t *timer)
+{
+	soft_timer_start(timer, absoluteInput.period, DALI_Input_AbsoluteDue);
+	absolute_flag = 1;
+}
+
+void DALI_Input_ButtonUpdate(uint8_t pressed)
+{
+	if(pressed == (button.state != BUTTON_RELEASED))
+	{
+		return;
+	}
+	if(pressed)
+	{
+		instances.inputValue[BUTTON_INSTANCE] = 0xFF;
+		DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_PRESSED_EVENT, BUTTON_PRESSED_FILTER);
+		if(button.doubleWait)
+		{
+			button.doubleWait = FALSE;
+			button.doublePress = TRUE;
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_DOUBLE_PRESS_EVENT, BUTTON_DOUBLE_PRESS_FILTER);
+		}
+		button.state = BUTTON_PRESSED;
+		soft_timer_start(&button.deadlineTimer, BUTTON_T_SHORT, DALI_Input_ButtonTimeout);
+	}
+	else
+	{
+		instances.inputValue[BUTTON_INSTANCE] = 0x00;
+		DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_RELEASED_EVENT, BUTTON_RELEASED_FILTER);
+		soft_timer_stop(&button.deadlineTimer);
+		switch(button.state)
+		{
+		case BUTTON_PRESSED:
+			if(button.doublePress == FALSE)
+			{
+				if(BUTTON_T_DOUBLE > 0)
+				{
+					// Short press is only known once no second press follows
+					button.doubleWait = TRUE;
+					soft_timer_start(&button.deadlineTimer, BUTTON_T_DOUBLE, DALI_Input_ButtonTimeout);
+				}
+				else
+				{
+					DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_SHORT_PRESS_EVENT, BUTTON_SHORT_PRESS_FILTER);
+				}
+			}
+			break;
+		case BUTTON_LONG_PRESS:
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_LONG_PRESS_STOP_EVENT, BUTTON_LONG_PRESS_STOP_FILTER);
+			break;
+		case BUTTON_STUCK:
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_FREE_EVENT, BUTTON_STUCK_FREE_FILTER);
+			break;
+		default:
+			break;
+		}
+		button.doublePress = FALSE;
+		button.state = BUTTON_RELEASED;
+	}
+}
+
+void DALI_Input_ButtonTimeout(soft_timer_t *timer)
+{
+	switch(button.state)
+	{
+	case BUTTON_RELEASED:
+		if(button.doubleWait)
+		{
+			button.doubleWait = FALSE;
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_SHORT_PRESS_EVENT, BUTTON_SHORT_PRESS_FILTER);
+		}
+		break;
+	case BUTTON_PRESSED:
+		button.state = BUTTON_LONG_PRESS;
+		button.heldTime = BUTTON_T_SHORT;
+		soft_timer_start(&button.deadlineTimer, BUTTON_T_REPEAT, DALI_Input_ButtonTimeout);
+		DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_LONG_PRESS_START_EVENT, BUTTON_LONG_PRESS_START_FILTER);
+		break;
+	case BUTTON_LONG_PRESS:
+		button.heldTime += BUTTON_T_REPEAT;
+		if(button.heldTime >= BUTTON_T_STUCK)
+		{
+			button.state = BUTTON_STUCK;
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_STUCK_EVENT, BUTTON_STUCK_FREE_FILTER);
+		}
+		else
+		{
+			soft_timer_start(&button.deadlineTimer, BUTTON_T_REPEAT, DALI_Input_ButtonTimeout);
+			DALI_Instance_RaiseEvent(BUTTON_INSTANCE, BUTTON_LONG_PRESS_REPEAT_EVENT, BUTTON_LONG_PRESS_REPEAT_FILTER);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void DALI_Input_OccupancyIntHandler(void)
+{
+	uint8_t movement = (readPin(PIR_Pin) == PIR_ACTIVE_LEVEL);
+	if(movement == occupancy.movement)
+	{
+		return;
+	}
+	occupancy.movement = movement;
+	if(movement)
+	{
+		// Occupied for as long as there is movement, the hold time starts when it stops
+		soft_timer_stop(&occupancy.holdTimer);
+		instances.inputValue[OCCUPANCY_INSTANCE] = OCCUPANCY_MOVEMENT_VALUE;
+		if(occupancy.occupied == FALSE)
+		{
+			occupancy.occupied = TRUE;
+			DALI_Input_OccupancyEvent(OCCUPANCY_OCCUPIED_BIT | OCCUPANCY_MOVEMENT_BIT, OCCUPANCY_OCCUPIED_FILTER);
+		}
+		else if(!soft_timer_running(&instances.deadTimer[OCCUPANCY_INSTANCE]))
+		{
+			DALI_Input_OccupancyEvent(OCCUPANCY_OCCUPIED_BIT | OCCUPANCY_MOVEMENT_BIT, OCCUPANCY_MOVEMENT_FILTER);
+		}
+	}
+	else
+	{
+		soft_timer_start(&occupancy.holdTimer, OCCUPANCY_T_HOLD, DALI_Input_OccupancyVacant);
+		instances.inputValue[OCCUPANCY_INSTANCE] = OCCUPANCY_OCCUPIED_VALUE;
+		if(!soft_timer_running(&instances.deadTimer[OCCUPANCY_INSTANCE]))
+		{
+			DALI_Input_OccupancyEvent(OCCUPANCY_OCCUPIED_BIT, OCCUPANCY_NO_MOVEMENT_FILTER);
+		}
+	}
+}
+
+void DALI_Input_OccupancyVacant(soft_timer_t *timer)
+{
+	occupancy.occupied = FALSE;
+	instances.inputValue[OCCUPANCY_INSTANCE] = OCCUPANCY_VACANT_VALUE;
+	DALI_Input_OccupancyEvent(0, OCCUPANCY_VACANT_FILTER);
+}
+
+void DALI_Input_OccupancyEvent(uint16_t eventInfo, uint32_t filter)
+{
+	// Every event restarts the report timer, movement events are also held back by the dead time
+	DALI_Instance_RestartTimers(OCCUPANCY_INSTANCE);
+	DALI_Instance_RaiseEvent(OCCUPANCY_INSTANCE, eventInfo, filter);
+}
+
+void DALI_Input_AbsoluteSample(uint32_t adcVal)
+{
+	uint16_t sample = adcVal;
+	uint16_t delta = (sample > absoluteInput.lastSample) ? (sample - absoluteInput.lastSample) : (absoluteInput.lastSample - sample);
+	absoluteInput.lastSample = sample;
+	if(delta > ABSOLUTE_SETTLE_DELTA)
+	{
+		absoluteInput.settleCount = 0;
+		absoluteInput.period = ABSOLUTE_T_FAST;
+	}
+	else if(absoluteInput.settleCount < ABSOLUTE_SETTLE_COUNT)
+	{
+		absoluteInput.settleCount++;
+	}
+	else
+	{
+		absoluteInput.period = ABSOLUTE_T_IDLE;
+	}
+	// The oversampled result is already MSB-aligned.
+	// Events follow the hysteresis and dead time of the value path
+	DALI_Instance_SetValue(ABSOLUTE_INPUT_INSTANCE, sample);
+}
+
+uint8_t DALI_Input_Hysteresis(uint8_t instance, uint16_t inputValue)
+{
+	if((inputValue <= instances.hysteresisBandHigh[instance]) && (inputValue >= instances.hysteresisBandLow[instance]))
+	{
+		return FALSE;
+	}
+	uint32_t hysteresisBand = fixed_ratio(inputValue, instances.hysteresis[instance], 100, instances.hysteresisMul[instance], HYSTERESIS_SHIFT);
+	if(hysteresisBand < instances.hysteresisMin[instance])
+		hysteresisBand = instances.hysteresisMin[instance];
+
+	if(inputValue > instances.hysteresisBandHigh[instance])
+	{
+		instances.hysteresisBandHigh[instance] = inputValue;
+		instances.hysteresisBandLow[instance] = (inputValue > hysteresisBand)? (inputValue - hysteresisBand) : 0;
+	}
+	else
+	{
+		instances.hysteresisBandLow[instance] = inputValue;
+		instances.hysteresisBandHigh[instance] = inputValue + hysteresisBand;
+	}
+	return TRUE;
+}
+
+uint8_t DALI_Input_IsEventDriven(uint8_t instanceType)
+{
+	return ((instanceType == PUSH_BUTTON) || (instanceType == OCCUPANCY_SENSOR));
+}
+
+void DALI_Input_Report(uint8_t instance)
+{
+	if((instance != OCCUPANCY_INSTANCE) || (instances.tReport[instance] == 0) || soft_timer_running(&instances.reportTimer[instance]))
+	{
+		return;
+	}
+	uint16_t eventInfo = OCCUPANCY_REPEAT_BIT;
+	if(occupancy.occupied)
+		eventInfo |= OCCUPANCY_OCCUPIED_BIT;
+	if(occupancy.movement)
+		eventInfo |= OCCUPANCY_MOVEMENT_BIT;
+	soft_timer_start(&instances.reportTimer[instance], instances.tReport[instance]*1000UL, DALI_Instance_ReportExpired);
+	DALI_Instance_RaiseEvent(instance, eventInfo, OCCUPANCY_REPEAT_FILTER);
+}
+
+uint32_t DALI_Input_DefaultEventFilter(uint8_t instanceType)
+{
+	switch(instanceType)
+	{
+	case PUSH_BUTTON:
+		return BUTTON_EVENT_FILTER_DEFAULT;
+	case OCCUPANCY_SENSOR:
+		return OCCUPANCY_EVENT_FILTER_DEFAULT;
+	default:
+		return 1;
+	}
+}
+
+uint8_t DALI_Input_DefaultResolution(uint8_t instanceType)
+{
+	switch(instanceType)
+	{
+	case PUSH_BUTTON:
+		return 1;
+	case OCCUPANCY_SENSOR:
+		return 2;
+	default:
+		return 10;
+	}
+}
+
+uint8_t DALI_Input_DefaultEventPriority(uint8_t instanceType)
+{
+	return (instanceType == OCCUPANCY_SENSOR) ? OCCUPANCY_EVENT_PRIORITY : 4;
+}
@@ -6,6 +6,7 @@
  */
 #include "dali_memory.h"
 #include "stm32f0xx_hal.h"
+#include "adc.h"
 
 
 uint8_t const lastByte_memory_bank_189			= 0x16;
@@ -14,26 +15,46 @@ uint8_t const lockByte_default					= 0xFF;
 uint16_t const fullScaleRange_default 			= 1000;
 uint8_t const calibrationScale_default			= 255;
 uint8_t const calibrationOffset_default			= 0;
+uint8_t const calibrationScale1_default			= 255;
+uint8_t const calibrationOffset1_default		= 0;
+uint8_t const compensationControl_default		= 0x01;	// Supply only, the dark drift depends on the photodiode
+int8_t const darkTemperatureCoeff_default		= 0;
 uint8_t const parameterLock_default				= 0xFF;
 uint8_t const factoryReset_default				= 0xFF;
 uint8_t const pidProportionalCoeff_default		= 0xFF;
 uint8_t const pidIntegralCoeff_default			= 0xFF;
 uint8_t const pidDerivativeCoeff_default		= 0xFF;
+uint8_t const filterType_default				= 4;	// Median then IIR
+uint8_t const filterLength_default				= 5;
+uint8_t const filterShift_default				= 2;
+uint8_t const lastByte_memory_bank_190			= linearisationTable_addr + 4*LINEARISATION_MAX_POINTS - 1;
+uint8_t const scopePeriod_default				= 10;	// 10 kHz, 51.2 ms of capture
 
 uint32_t memory_bank_addr[256] = {0};
 uint8_t lock_byte[256];	// Locked by set to 0x55
+// The linearisation table is written point by point and committed to flash in one erase
+uint32_t memory_bank_190_shadow[(linearisationTable_addr + 4*LINEARISATION_MAX_POINTS)/4];
+uint8_t memory_bank_191[dispatchLatency_addr + 2] = {0xFF};	// Last accessible byte 0xFF
+
+// Private functions
+void memory_bank_190_commit(void);
 // If more memory banks are defined, the dali_memory_init function needs to be modified too
 void dali_memory_init(void)
 {
 	memory_bank_addr[0] = MEMORY_BANK_0_ADDR;
 	memory_bank_addr[189] = MEMORY_BANK_189_ADDR;
+	memory_bank_addr[LINEARISATION_BANK] = MEMORY_BANK_190_ADDR;
 	lock_byte[189] = 0xFF;
+	lock_byte[LINEARISATION_BANK] = 0xFF;
+	memory_bank_addr[SCOPE_BANK] = (uint32_t) memory_bank_191;
+	lock_byte[SCOPE_BANK] = 0xFF;
+	scopePeriod = scopePeriod_default;
 	if((* (uint8_t*) (MEMORY_BANK_0_ADDR)) == 0xFF)
 	{
 		dali_NVM_unlock();
 		// Implement memory bank 0
 		(* (uint16_t*) (MEMORY_BANK_0_ADDR)) = 0xFF1A;
-		(* (uint16_t*) (MEMORY_BANK_0_ADDR + 0x02)) = 0xBD;		// Last accessible memory bank = 189, MSB GTIN = 0
+		(* (uint16_t*) (MEMORY_BANK_0_ADDR + 0x02)) = 0xBF;		// Last accessible memory bank = 191, MSB GTIN = 0
 		(* (uint16_t*) (MEMORY_BANK_0_ADDR + 0x04)) = 0x3CC8;	// GTIN = 0x00 C8 3C 58 86 4A
 		(* (uint16_t*) (MEMORY_BANK_0_ADDR + 0x06)) = 0x8658;
 		(* (uint16_t*) (MEMORY_BANK_0_ADDR + 0x08)) = 0x4A;		// GTIN LSB = 0x4A; fw major version = 0
@@ -48,10 +69,25 @@ void dali_memory_init(void)
 		(* (uint16_t*) (MEMORY_BANK_189_ADDR)) = 0xFF16;
 		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x04)) = (calibrationScale_default << 8) | factoryReset_default;
 		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x06)) = (pidProportionalCoeff_default << 8) | (calibrationOffset_default);
+		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x0C)) = (filterLength_default << 8) | filterType_default;
+		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x0E)) = (calibrationScale1_default << 8) | filterShift_default;
+		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x10)) = (compensationControl_default << 8) | calibrationOffset1_default;
+		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x12)) = 0xFF00 | (uint8_t)darkTemperatureCoeff_default;
 		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x14)) = ((fullScaleRange_default & 0xFF) << 8) | 0xFF;
 		(* (uint16_t*) (MEMORY_BANK_189_ADDR + 0x16)) = 0xFF00 | (fullScaleRange_default >> 8);
 		dali_NVM_lock();
 	}
+	if((* (uint8_t*) (MEMORY_BANK_190_ADDR)) == 0xFF)
+	{
+		// Implement memory bank 190 without a table, the two-point calibration is used
+		dali_NVM_unlock();
+		(* (uint16_t*) (MEMORY_BANK_190_ADDR)) = 0xFF00 | lastByte_memory_bank_190;
+		dali_NVM_lock();
+	}
+	for(uint8_t i = 0; i < sizeof(memory_bank_190_shadow)/4; i++)
+	{
+		memory_bank_190_shadow[i] = * (uint32_t *) (MEMORY_BANK_190_ADDR + i*4);
+	}
 }
 
 uint32_t erase_page(uint32_t page_address)
@@ -114,6 +150,25 @@ memory_read_t dali_memory_read(uint8_t memory_bank_number, uint8_t memory_offset
 		{
 			read.value = 0xFF;
 		}
+		else if((memory_bank_number == 189) && ((memory_offset == calibrateDark) || (memory_offset == calibrateFullScale)))
+		{
+			read.value = calibrationStatus[memory_offset - calibrateDark];
+		}
+		else if(memory_bank_number == LINEARISATION_BANK)
+		{
+			read.value = ((uint8_t *) memory_bank_190_shadow)[memory_offset];	// Includes points not committed yet
+		}
+		else if(memory_bank_number == SCOPE_BANK)
+		{
+			if(memory_offset >= scopeWindow_addr)
+				read.value = ((uint8_t *) adc_scope_buffer)[scopeBlock*SCOPE_BLOCK_SIZE + memory_offset - scopeWindow_addr];
+			else if(memory_offset == scopeControl_addr)
+				read.value = adc_scope_state;
+			else if(memory_offset < sizeof(memory_bank_191))
+				read.value = memory_bank_191[memory_offset];
+			else
+				read.value = 0xFF;	// Reserved
+		}
 		else
 		{
 			read.value = *(uint8_t *)read_address;
@@ -133,101 +188,120 @@ uint8_t dali_memory_write(uint8_t memory_bank_number, uint8_t memory_offset, uin
 		lock_byte[memory_bank_number] = data;
 		return 0;
 	}
-	if((memory_bank_number == 189))
+	if((memory_bank_number == 189) && (memory_offset == factoryReset_addr))
 	{
-		if(memory_offset == factoryReset_addr)
-		{
-			return (data) ? 0 : 2;
-		}
-		else if(memory_offset == calibrateDark)
-		{
-			darkCalibrate = 1;
-			return 0;
-		}
-		else if(memory_offset == calibrateFullScale)
-		{
-			fullScaleCalibrate = 1;
-			return 0;
-		}
+		return (data) ? 0 : 2;
 	}
 	// Check if the memory bank location is locked or not implemented
-	else if((memory_bank_addr[memory_bank_number] == 0) || (lock_byte[memory_bank_number] != 0x55) || (memory_offset > * (uint8_t *) memory_bank_address) || ((memory_bank_number == 189) && (memory_offset != parameterLock_addr) && (parameterLock!= 0)))
+	if((memory_bank_addr[memory_bank_number] == 0) || (lock_byte[memory_bank_number] != 0x55) || (memory_offset > * (uint8_t *) memory_bank_address) || ((memory_bank_number == 189) && (memory_offset != parameterLock_addr) && (parameterLock!= 0)))
 	{
 		return 1;
 	}
-	else
+	// Calibration requests are taken by the calibration engine, which writes the result to the bank
+	if((memory_bank_number == 189) && (memory_offset == calibrateDark))
+	{
+		darkCalibrate = 1;
+		calibrationStatus[0] = CALIBRATION_BUSY;
+		return 0;
+	}
+	if((memory_bank_number == 189) && (memory_offset == calibrateFullScale))
+	{
+		fullScaleCalibrate = 1;
+		calibrationStatus[1] = CALIBRATION_BUSY;
+		return 0;
+	}
+	if(memory_bank_number == LINEARISATION_BANK)
 	{
-		return 2;
+		// Stage the byte, only the number of points goes on to the flash commit
+		if(memory_offset < linearisationPoints_addr)
+			return 1;
+		((uint8_t *) memory_bank_190_shadow)[memory_offset] = data;
+		return (memory_offset == linearisationPoints_addr) ? 2 : 0;
 	}
+	if(memory_bank_number == SCOPE_BANK)
+	{
+		// RAM only, the capture window cannot be written
+		if(memory_offset == scopeControl_addr)
+			scopeRequest = 1;
+		else if(memory_offset == scopeBlock_addr)
+			scopeBlock = data & (SCOPE_BLOCKS - 1);
+		else if((memory_offset == scopePeriod_addr) || (memory_offset == scopeChannel_addr))
+			memory_bank_191[memory_offset] = data;
+		else if(memory_offset == dispatchLatency_addr)
+		{
+			memory_bank_191[dispatchLatency_addr] = 0;
+			memory_bank_191[dispatchLatency_addr + 1] = 0;
+		}
+		else
+			return 1;
+		return 0;
+	}
+	return 2;
+}
+
+uint8_t dali_memory_scope_read(uint8_t memory_offset)
+{
+	uint8_t value = ((uint8_t *) adc_scope_buffer)[scopeBlock*SCOPE_BLOCK_SIZE + memory_offset - scopeWindow_addr];
+	if(memory_offset == 0xFF)
+		scopeBlock = (scopeBlock + 1) & (SCOPE_BLOCKS - 1);
+	return value;
 }
 
 // Need to split the write function into 2 separate functions so that the device can response with a backframe without waiting for the memory write
 void memory_write(uint8_t memory_bank_number, uint8_t memory_offset, uint8_t data)
 {
-	uint32_t memory_bank_address = memory_bank_addr[memory_bank_number];
-	uint32_t write_address = memory_bank_address + memory_offset;
 	if((memory_bank_number == 189) && (memory_offset == factoryReset_addr) && (data == 0))
 		dali_memory_reset(189);
+	else if(memory_bank_number == LINEARISATION_BANK)
+		memory_bank_190_commit();
 	else
+		memory_write_bytes(memory_bank_number, 1, &memory_offset, &data);
+}
+
+void memory_write_bytes(uint8_t memory_bank_number, uint8_t count, const uint8_t *memory_offset, const uint8_t *data)
+{
+	uint32_t memory_bank_address = memory_bank_addr[memory_bank_number];
+	// Add up to 4 memory temporary banks if more banks are implemented in one memory page (1 page = 4 banks)
+	// Currently only implement 2 memory banks, each stays on separate memory page so we only need 1 storing array
+	uint32_t memory_temp_0[64];
+	uint32_t memory_page_addr = (memory_bank_address/0x400)*0x400;
+	// Words up to the last accessible byte, taken before the erase clears it
+	uint8_t memory_words = ((* (uint8_t *) memory_page_addr)/4) + 1;
+	for (uint8_t i = 0; i < memory_words; i++) // Only save implemented locations in the memory bank
 	{
-		// Add up to 4 memory temporary banks if more banks are implemented in one memory page (1 page = 4 banks)
-			// Currently only implement 2 memory banks, each stays on separate memory page so we only need 1 storing array
-			uint32_t memory_temp_0[64];
-			uint32_t memory_page_addr = (memory_bank_address/0x400)*0x400;
-			dali_NVM_unlock();
-			for (uint8_t i = 0; i < ((* (uint8_t *) memory_page_addr)/4); i++) // Only save implemented locations in the memory bank
-			{
-				memory_temp_0[i] = * (uint32_t *) (memory_page_addr + i*4);
-			}
-
-			// Erase memory page
-			uint32_t erase_err = erase_page(memory_page_addr);
-			if (erase_err != 0xFFFFFFFF)
-			{
-				return 1;
-			}
-
-			// Modify the temporary memory with the new data
-			uint32_t temp;
-			temp = memory_temp_0[(write_address - memory_page_addr)/4];
-
-			switch(write_address % 4)
-			{
-			case 0:
-				temp = (temp & 0xFFFFFF00) | data;
-				break;
-			case 1:
-				temp = (temp & 0xFFFF0000) | (data << 8) | (temp & 0xFF);
-				break;
-			case 2:
-				temp = (temp & 0xFF000000) | (data << 16) | (temp & 0xFFFF);
-				break;
-			case 3:
-				temp = (data << 24) | (temp & 0xFFFFFF);
-				break;
-			}
-			memory_temp_0[(write_address - memory_page_addr)/4] = temp;
-
-			// Write back temporary data to flash
-			for (uint8_t i = 0; i < ((* (uint8_t *) memory_page_addr)/4); i++)
-			{
-				__disable_irq();
-				HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, memory_page_addr + i*4, memory_temp_0[i]);
-				__enable_irq();
-			}
-			dali_NVM_lock();
+		memory_temp_0[i] = * (uint32_t *) (memory_page_addr + i*4);
+	}
+
+	// Erase memory page
+	uint32_t erase_err = erase_page(memory_page_addr);
+	if (erase_err != 0xFFFFFFFF)
+	{
+		return;
+	}
+	dali_NVM_unlock();
+
+	// Modify the temporary memory with the new data
+	for (uint8_t n = 0; n < count; n++)
+	{
+		((uint8_t *) memory_temp_0)[memory_bank_address + memory_offset[n] - memory_page_addr] = data[n];
+	}
+
+	// Write back temporary data to flash
+	for (uint8_t i = 0; i < memory_words; i++)
+	{
+		__disable_irq();
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, memory_page_addr + i*4, memory_temp_0[i]);
+		__enable_irq();
 	}
+	dali_NVM_lock();
 }
 void dali_memory_reset(uint8_t memory_bank_number)
 {
-	if ((memory_bank_number == 0) || (memory_bank_number == 189))
+	// Skip the banks that are locked
+	if (((memory_bank_number == 0) || (memory_bank_number == 189)) && (lock_byte[189] == 0x55))
 	{
-		// return if all bytes are locked
-		if (lock_byte[189] != 0x55)
-			return;
-		dali_NVM_unlock();
-		// Currently only 1 memory bank is manufacturer-implemented, so reset all is the same as reset 1 bank
 		uint32_t erase_err = erase_page(MEMORY_BANK_189_ADDR);
+		dali_NVM_unlock();	// erase_page leaves the flash locked
 
 		// Write default values
 		uint32_t dataW = (parameterLock_default << 24) | (lockByte_default << 16) | (indicatorByte << 8) | lastByte_memory_bank_189;
@@ -237,8 +311,47 @@ void dali_memory_reset(uint8_t memory_bank_number)
 		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, MEMORY_BANK_189_ADDR + 4, dataW);
 		dataW = (fullScaleRange_default << 16) | (pidDerivativeCoeff_default << 8) | pidIntegralCoeff_default ;
 		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, MEMORY_BANK_189_ADDR + 8, dataW);
+		dataW = (calibrationScale1_default << 24) | (filterShift_default << 16) | (filterLength_default << 8) | filterType_default;
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, MEMORY_BANK_189_ADDR + 0x0C, dataW);
+		dataW = 0xFF000000 | ((uint8_t)darkTemperatureCoeff_default << 16) | (compensationControl_default << 8) | calibrationOffset1_default;
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, MEMORY_BANK_189_ADDR + 0x10, dataW);
 		__enable_irq();
 		dali_NVM_lock();
 		lock_byte[189] = 0;
 	}
+	if (((memory_bank_number == 0) || (memory_bank_number == LINEARISATION_BANK)) && (lock_byte[LINEARISATION_BANK] == 0x55))
+	{
+		// Drop the table, the two-point calibration is used again
+		memory_bank_190_shadow[0] = 0xFFFFFF00 | lastByte_memory_bank_190;
+		for(uint8_t i = 1; i < sizeof(memory_bank_190_shadow)/4; i++)
+		{
+			memory_bank_190_shadow[i] = 0xFFFFFFFF;
+		}
+		memory_bank_190_commit();
+		lock_byte[LINEARISATION_BANK] = 0;
+	}
+	if (((memory_bank_number == 0) || (memory_bank_number == SCOPE_BANK)) && (lock_byte[SCOPE_BANK] == 0x55))
+	{
+		scopePeriod = scopePeriod_default;
+		scopeChannel = 0;
+		scopeBlock = 0;
+		lock_byte[SCOPE_BANK] = 0;
+	}
+}
+
+void memory_bank_190_commit(void)
+{
+	uint32_t erase_err = erase_page(MEMORY_BANK_190_ADDR);
+	if (erase_err != 0xFFFFFFFF)
+	{
+		return;
+	}
+	dali_NVM_unlock();
+	for (uint8_t i = 0; i < sizeof(memory_bank_190_shadow)/4; i++)
+	{
+		__disable_irq();
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, MEMORY_BANK_190_ADDR + i*4, memory_bank_190_shadow[i]);
+		__enable_irq();
+	}
+	dali_NVM_lock();
 }
@@ -61,16 +61,26 @@ void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOF, &GPIO_InitStruct);
 
-  /*Configure GPIO pins : PA0 PA2 PA3 PA5 
-                           PA6 PA7 PA8 PA11 
-                           PA12 */
-  GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_2|GPIO_PIN_3|GPIO_PIN_5 
-                          |GPIO_PIN_6|GPIO_PIN_7|GPIO_PIN_8|GPIO_PIN_11 
-                          |GPIO_PIN_12;
+  /*Configure GPIO pins : PA0 PA5 PA6 PA7 
+                           PA8 PA11 PA12 */
+  GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_5|GPIO_PIN_6|GPIO_PIN_7 
+                          |GPIO_PIN_8|GPIO_PIN_11|GPIO_PIN_12;
   GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : PtPin */
+  GPIO_InitStruct.Pin = BUTTON_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(BUTTON_GPIO_Port, &GPIO_InitStruct);
+
+  /*Configure GPIO pin : PtPin */
+  GPIO_InitStruct.Pin = PIR_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+  HAL_GPIO_Init(PIR_GPIO_Port, &GPIO_InitStruct);
+
   /*Configure GPIO pin : PtPin */
   GPIO_InitStruct.Pin = SENSOR_CONFIG_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
@@ -113,6 +123,9 @@ void MX_GPIO_Init(void)
   HAL_GPIO_Init(TP_GPIO_Port, &GPIO_InitStruct);
 
   /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI2_3_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(EXTI2_3_IRQn);
+
   HAL_NVIC_SetPriority(EXTI4_15_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(EXTI4_15_IRQn);
 
@@ -133,7 +146,7 @@ void writePin(uint16_t pin, uint8_t PinState)
 
 uint8_t readPin(uint16_t pin)
 {
-	if((pin == TX_Pin) || (pin == RX_Pin) || (pin == SENSOR_CONFIG_Pin))
+	if((pin == TX_Pin) || (pin == RX_Pin) || (pin == SENSOR_CONFIG_Pin) || (pin == BUTTON_Pin) || (pin == PIR_Pin))
 	{
 		return HAL_GPIO_ReadPin(GPIOA, pin);
 	}
@@ -142,37 +155,6 @@ uint8_t readPin(uint16_t pin)
 		return HAL_GPIO_ReadPin(GPIOB, pin);
 	}
 }
-// Rx_Pin use EXTI line 10
-bool_t int_dali_is_falling()
-{
-	return (READ_BIT(EXTI->FTSR, (1<<10)) > 0);
-}
-
-bool_t int_dali_is_rising()
-{
-	return (READ_BIT(EXTI->RTSR, (1<<10)) > 0);
-}
-void int_dali_falling()
-{
-	SET_BIT(EXTI->FTSR, (1<<10));
-	CLEAR_BIT(EXTI->RTSR, (1<<10));
-}
-void int_dali_rising()
-{
-	SET_BIT(EXTI->RTSR, (1<<10));
-	CLEAR_BIT(EXTI->FTSR, (1<<10));
-}
-void int_dali_toggle()
-{
-	if(int_dali_is_falling())
-	{
-		int_dali_rising();
-	}
-	else
-	{
-		int_dali_falling();
-	}
-}
 /* USER CODE END 2 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,178 @@
+/*
+ * low_power.c
+ * This file implements the STOP mode idle of the main loop. The RTC runs from the LSI
+ * and wakes the core up for the next software timer deadline or the next light sensor
+ * sample, the DALI RX edge wakes it up for a frame
+ */
+
+#include "low_power.h"
+#include "main.h"
+#include "adc.h"
+#include "dali.h"
+#include "dali_timing.h"
+#include "soft_timer.h"
+#include "tim.h"
+
+uint32_t lsi_hz = LOW_POWER_LSI_DEFAULT;
+uint32_t stop_residue = 0;				// LSI ticks times 1000 not yet credited to the software timers
+uint16_t wake_ssr;						// RTC sub-seconds and time base when the core last woke up,
+uint32_t wake_time;						// the awake time measures the LSI again
+#ifdef DEBUG
+// DEBUG: longest time interrupts stayed masked after a start bit woke the core, in TIM2 counts.
+// The edges of the frame are only timestamped from then on, it must stay well below TE
+volatile uint16_t wakeMaskedTime = 0;
+#endif
+
+// Private functions
+uint16_t low_power_ssr(void);
+void low_power_set_alarm(uint16_t ssr);
+void low_power_measure_lsi(uint16_t ssr, uint32_t time);
+void low_power_restore_clock(uint8_t edge);
+
+void low_power_init(void)
+{
+	__HAL_RCC_PWR_CLK_ENABLE();
+	PWR->CR |= PWR_CR_DBP;
+	// The RTC is only used for its sub-second counter, the calendar is never read
+	if((RCC->BDCR & RCC_BDCR_RTCEN) == 0)
+	{
+		RCC->BDCR |= RCC_BDCR_BDRST;
+		RCC->BDCR &= ~RCC_BDCR_BDRST;
+		RCC->BDCR |= RCC_BDCR_RTCSEL_LSI | RCC_BDCR_RTCEN;
+	}
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+	RTC->ISR |= RTC_ISR_INIT;
+	while((RTC->ISR & RTC_ISR_INITF) == 0);
+	RTC->PRER = LOW_POWER_RTC_PREDIV_S;
+	RTC->PRER = LOW_POWER_RTC_PREDIV_S;		// PREDIV_A = 0, written after PREDIV_S
+	RTC->ISR &= ~RTC_ISR_INIT;
+	// Read the counters directly, the shadow registers need a resync after every STOP
+	RTC->CR |= RTC_CR_BYPSHAD | RTC_CR_ALRAIE;
+	RTC->ALRMAR = RTC_ALRMAR_MSK4 | RTC_ALRMAR_MSK3 | RTC_ALRMAR_MSK2 | RTC_ALRMAR_MSK1;
+	RTC->WPR = 0xFF;
+	// Alarm A reaches the NVIC and the STOP wakeup through EXTI line 17
+	EXTI->IMR |= EXTI_IMR_MR17;
+	EXTI->RTSR |= EXTI_RTSR_TR17;
+	HAL_NVIC_SetPriority(RTC_IRQn, 2, 0);
+	HAL_NVIC_EnableIRQ(RTC_IRQn);
+	// 50 ms of LSI ticks against the time base
+	uint16_t ssr = low_power_ssr();
+	uint32_t time = get_time_base();
+	while(get_time_base() - time < 100000);
+	lsi_hz = 0;
+	low_power_measure_lsi(ssr, time);
+	if(lsi_hz == 0)
+		lsi_hz = LOW_POWER_LSI_DEFAULT;
+	wake_ssr = low_power_ssr();
+	wake_time = get_time_base();
+}
+
+uint8_t low_power_stop(void)
+{
+	uint32_t next = soft_timer_next();
+	// A light sensor result between two STOPs, and none waiting for the main loop
+	if((next < LOW_POWER_MIN_STOP) || (adc_sampled == 0) || (adc_result_ready != 0) || (adc_scope_state == ADC_SCOPE_BUSY))
+		return 0;
+	__disable_irq();
+	if(DALIStopAllowed() == 0)
+	{
+		__enable_irq();
+		return 0;
+	}
+	if(next > LOW_POWER_SAMPLE_PERIOD)
+		next = LOW_POWER_SAMPLE_PERIOD;
+	low_power_measure_lsi(wake_ssr, wake_time);
+	uint16_t start = low_power_ssr();
+	low_power_set_alarm(start - (next*lsi_hz)/1000);
+	adc_suspend();
+	// Interrupts stay masked, a pending one still ends the STOP but only runs once the clocks are set right
+	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+	uint8_t edge = DALIStopWake();
+	low_power_restore_clock(edge);
+	wake_ssr = low_power_ssr();
+	wake_time = get_time_base();
+	// The sub-second counter counts down, LSI ticks to ms with the remainder kept for the next STOP
+	stop_residue += ((start - wake_ssr) & LOW_POWER_RTC_PREDIV_S) * 1000UL;
+	soft_timer_skip(stop_residue / lsi_hz);
+	stop_residue %= lsi_hz;
+#ifdef DEBUG
+	if(edge != 0)
+	{
+		uint32_t masked = tim2_get_count() - TE_STOP_WAKE;
+		if(masked > wakeMaskedTime)
+			wakeMaskedTime = masked;
+	}
+#endif
+	// The clocks and the timers are right again. The start bit edge is taken before the ADC restarts,
+	// the mid-bit edge would otherwise merge into its pending flag
+	__enable_irq();
+	// The ADC clock restarts with the core
+	if((RCC->CR2 & RCC_CR2_HSI14ON) != 0)
+	{
+		while((RCC->CR2 & RCC_CR2_HSI14RDY) == 0);
+	}
+	adc_resume();
+	return 1;
+}
+
+void low_power_alarm(void)
+{
+	RTC->ISR = (~(RTC_ISR_ALRAF | RTC_ISR_INIT)) & 0x0001FFFF;
+	EXTI->PR = EXTI_PR_PR17;
+}
+
+uint16_t low_power_ssr(void)
+{
+	// Without the shadow register the counter is read asynchronously, twice the same value is a good one
+	uint16_t ssr = RTC->SSR;
+	uint16_t again = RTC->SSR;
+	while(ssr != again)
+	{
+		ssr = again;
+		again = RTC->SSR;
+	}
+	return ssr;
+}
+
+void low_power_set_alarm(uint16_t ssr)
+{
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+	RTC->CR &= ~RTC_CR_ALRAE;
+	while((RTC->ISR & RTC_ISR_ALRAWF) == 0);
+	// Only the 15 sub-second bits are compared, the alarm matches once per wrap of the counter, about 0.8 s
+	RTC->ALRMASSR = RTC_ALRMASSR_MASKSS | (ssr & LOW_POWER_RTC_PREDIV_S);
+	RTC->CR |= RTC_CR_ALRAE;
+	RTC->WPR = 0xFF;
+	low_power_alarm();
+}
+
+void low_power_measure_lsi(uint16_t ssr, uint32_t time)
+{
+	// Awake time between 10 ms and 0.5 s, long enough to resolve and short of a counter wrap
+	uint32_t elapsed = get_time_base() - time;
+	if((elapsed < 20000) || (elapsed > 1000000))
+		return;
+	uint32_t ticks = (ssr - low_power_ssr()) & LOW_POWER_RTC_PREDIV_S;
+	uint32_t measured = (ticks * 20000UL) / (elapsed / 100);
+	// The first measurement is taken as is, later ones follow temperature and supply slowly
+	if(lsi_hz == 0)
+		lsi_hz = measured;
+	else
+		lsi_hz = lsi_hz - (lsi_hz >> 3) + (measured >> 3);
+}
+
+void low_power_restore_clock(uint8_t edge)
+{
+#ifdef CLOCK_PROFILE_48MHZ
+	// STOP always ends on the HSI, which is the low power profile. Until the PLL is back tim2 counts
+	// at a sixth of its tick, the ticks it missed are added when a start bit ended the STOP
+	uint32_t count = tim2_get_count();
+	SystemClock_Config();
+	HAL_SuspendTick();
+	uint32_t now = tim2_get_count();
+	if(edge != 0)
+		tim2_set_count(now + (now - count)*(SYSCLK_HZ/HSI_VALUE - 1));
+#endif
+}
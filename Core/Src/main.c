@@ -21,6 +21,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
 #include "adc.h"
+#include "dma.h"
 #include "iwdg.h"
 #include "tim.h"
 #include "gpio.h"
@@ -31,6 +32,12 @@
 #include "dali.h"
 #include "dali_memory.h"
 #endif
+#include "dali_input.h"
+#include "dali_filter.h"
+#include "dali_calibration.h"
+#include "dali_flicker.h"
+#include "soft_timer.h"
+#include "low_power.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -41,6 +48,10 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 //#define DEBUG 1
+// The PLL runs all the time the core is awake, only STOP falls back to the HSI
+#if defined(CLOCK_PROFILE_48MHZ) && !defined(LOW_POWER_STOP)
+#error "CLOCK_PROFILE_48MHZ requires LOW_POWER_STOP"
+#endif
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -52,15 +63,27 @@
 
 /* USER CODE BEGIN PV */
 volatile uint8_t adc_flag;
-volatile uint16_t adc_time = 1000;
+soft_timer_t adc_poll_timer;
 uint32_t sensor_val;
+uint8_t sensor_index = ADC_RESULT_CH9;
+uint8_t absolute_index = ADC_RESULT_CH1;
+uint8_t second_index = ADC_RESULT_CH1;
+uint8_t dual_sensor = FALSE;
+uint8_t sensor_window = 0;
+// Hysteresis band of the second light sensor in 12-bit counts, checked in software since the analog watchdog has one channel
+uint8_t second_window = FALSE;
+uint16_t second_low, second_high;
 uint8_t darkCalibrate = 0;
 uint8_t fullScaleCalibrate = 0;
+uint8_t scopeRequest = 0;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
+void checkSensorType(void);
+void updateSensorWindow(void);
+void adcPollExpired(soft_timer_t *timer);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -97,28 +120,36 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_ADC_Init();
   MX_IWDG_Init();
   MX_TIM2_Init();
   MX_TIM3_Init();
   MX_TIM6_Init();
   MX_TIM14_Init();
+  MX_TIM15_Init();
   /* USER CODE BEGIN 2 */
-  ADC_ChannelConfTypeDef sConfig = {0};
-  sConfig.Channel = ADC_CHANNEL_1;
-  sConfig.Rank = ADC_RANK_NONE;
-  sConfig.SamplingTime = ADC_SAMPLETIME_239CYCLES_5;
-  if (HAL_ADC_ConfigChannel(&hadc, &sConfig) != HAL_OK)
-  {
-    Error_Handler();
-  }
+  checkSensorType();
+  adc_watchdog_init(sensor_index);
+  adc_start();
+  HAL_TIM_Base_Start(&htim15);
   HAL_TIM_Base_Start(&htim2);
   HAL_TIM_Base_Start(&htim3);
   HAL_TIM_Base_Start_IT(&htim6);
+  soft_timer_init();
+#ifdef LOW_POWER_STOP
+  low_power_init();
+#endif
+  soft_timer_start(&adc_poll_timer, 1000, adcPollExpired);
   DALI_AppInit();
+  DALI_Flicker_Init();
+  // Only one of the absolute input and the second light sensor has a channel
+  if(dual_sensor == TRUE)
+	  instances.instanceError[ABSOLUTE_INPUT_INSTANCE] = TRUE;
+  else
+	  instances.instanceError[SECOND_LIGHT_SENSOR_INSTANCE] = TRUE;
   writePin(LED_Pin, 1);
   __HAL_IWDG_START(&hiwdg);
-  HAL_TIM_Base_Start_IT(&htim14);
   /* USER CODE END 2 */
  
  
@@ -128,31 +159,107 @@ int main(void)
   while (1)
   {
 	  HAL_IWDG_Refresh(&hiwdg);
-	  DALI_ProcessRxData();
+	  // Commands are processed in PendSV. They only wait while the loop holds the dispatch lock,
+	  // which the application functions take around the state they share with the commands
 	  if(powerNoti_flag == 1)
 	  {
 		  DALI_Send_PowerCycleEvent();
 		  powerNoti_flag = 0;
 	  }
+	  // The DMA keeps converting, the loop only takes the latest oversampled results
+	  if(adc_result_ready == 1)
+	  {
+		  adc_result_ready = 0;
+		  // The conversion and the filters belong to the loop, a command only asks for them to be reloaded
+		  if(conversionPending == 1)
+		  {
+			  conversionPending = 0;
+			  DALI_Update_Conversion();
+			  sensor_window = 1;
+		  }
+		  adc_check_drift();
+		  adc_compensation_update();
+		  uint16_t samples[LIGHT_SENSORS] = {adc_compensate(adc_result[sensor_index]), adc_compensate(adc_result[second_index])};
+		  DALI_Filter_Update(&illuminanceFilter[0], samples[0]);
+		  DALI_Calibration_Update(samples, dual_sensor ? 2 : 1, &adc_sample_error);
+		  // The light sensor left its hysteresis band, take the filtered value now instead of at the next poll
+		  if(adc_window_flag == 1)
+		  {
+			  adc_window_flag = 0;
+			  DALI_Set_inputValue(LIGHT_SENSOR_INSTANCE, illuminanceFilter[0].output);
+			  sensor_window = 1;
+		  }
+		  if(dual_sensor == TRUE)
+		  {
+			  uint16_t level = DALI_Filter_Update(&illuminanceFilter[1], samples[1]) >> 4;
+			  if((second_window == TRUE) && ((level < second_low) || (level > second_high)))
+			  {
+				  second_window = FALSE;
+				  DALI_Set_inputValue(SECOND_LIGHT_SENSOR_INSTANCE, illuminanceFilter[1].output);
+				  sensor_window = 1;
+			  }
+		  }
+	  }
+	  // Scope capture requested through memory bank 191, the light sensor results pause until it is over
+	  if(scopeRequest == 1)
+	  {
+		  scopeRequest = 0;
+		  adc_scope_start((scopeChannel == 0) ? sensor_index : second_index, scopePeriod);
+	  }
+	  if(adc_scope_flag == 1)
+	  {
+		  adc_scope_flag = 0;
+		  adc_scope_finish();
+		  sensor_window = 1;
+	  }
+	  if(adc_error == 1)
+	  {
+		  instances.instanceError[LIGHT_SENSOR_INSTANCE] = TRUE;
+		  instances.instanceError[(dual_sensor == TRUE) ? SECOND_LIGHT_SENSOR_INSTANCE : ABSOLUTE_INPUT_INSTANCE] = TRUE;
+	  }
+	  // Light sensor polling, only used while the band cannot be watched by the ADC
 	  if(adc_flag == 1)
 	  {
 		  adc_flag = 0;
-		  adc_time = 1000; //1000 ms
-		  HAL_ADCEx_Calibration_Start(&hadc);
-		  HAL_ADC_Start(&hadc);
-		  if(HAL_ADC_PollForConversion(&hadc, 200) == HAL_OK)
+		  sensor_val = illuminanceFilter[0].output;
+		  DALI_Set_inputValue(LIGHT_SENSOR_INSTANCE, sensor_val);
+		  if(dual_sensor == TRUE)
+			  DALI_Set_inputValue(SECOND_LIGHT_SENSOR_INSTANCE, illuminanceFilter[1].output);
+		  sensor_window = 1;
+	  }
+	  if((absolute_flag == 1) && (dual_sensor == FALSE))
+	  {
+		  absolute_flag = 0;
+		  DALI_Input_AbsoluteSample(adc_result[absolute_index]);
+	  }
+	  if(instancePending != 0)
+	  {
+		  // tReport heartbeats and the end of tDeadtime report a fresh light sensor value
+		  if((instancePending & (1UL << LIGHT_SENSOR_INSTANCE)) != 0)
 		  {
-			  sensor_val = HAL_ADC_GetValue(&hadc);
-			  DALI_Set_inputValue(sensor_val);
-			  DALI_SendEvent();
+			  DALI_Set_inputValue(LIGHT_SENSOR_INSTANCE, illuminanceFilter[0].output);
 		  }
-		  else
+		  if((dual_sensor == TRUE) && ((instancePending & (1UL << SECOND_LIGHT_SENSOR_INSTANCE)) != 0))
 		  {
-			  instanceError = TRUE;
+			  DALI_Set_inputValue(SECOND_LIGHT_SENSOR_INSTANCE, illuminanceFilter[1].output);
 		  }
-		  HAL_ADC_Stop(&hadc);
+		  DALI_SendEvent();
+		  sensor_window = 1;
+	  }
+	  if(sensor_window == 1)
+	  {
+		  sensor_window = 0;
+		  updateSensorWindow();
+	  }
+	  // A flicker bin takes about a millisecond, it takes the lock only for its report.
+	  // Nothing wakes the core between two bins, it stays awake until the analysis is done
+	  if(DALI_Flicker_Update(sensor_index) == 0)
+	  {
+#ifdef LOW_POWER_STOP
+		  if(low_power_stop() == 0)
+#endif
+		  HAL_PWR_EnterSLEEPMode(0, PWR_SLEEPENTRY_WFI);
 	  }
-	  HAL_PWR_EnterSLEEPMode(0, PWR_SLEEPENTRY_WFI);
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -178,7 +285,15 @@ void SystemClock_Config(void)
   RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
   RCC_OscInitStruct.HSI14CalibrationValue = 16;
   RCC_OscInitStruct.LSIState = RCC_LSI_ON;
+#ifdef CLOCK_PROFILE_48MHZ
+  // HSI/2 * 12
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+  RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL12;
+  RCC_OscInitStruct.PLL.PREDIV = RCC_PREDIV_DIV1;
+#else
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+#endif
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
     Error_Handler();
@@ -187,11 +302,16 @@ void SystemClock_Config(void)
   */
   RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                               |RCC_CLOCKTYPE_PCLK1;
+#ifdef CLOCK_PROFILE_48MHZ
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+#else
   RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+#endif
   RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
   RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
 
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+  // One flash wait state above 24MHz
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, (SYSCLK_HZ > 24000000) ? FLASH_LATENCY_1 : FLASH_LATENCY_0) != HAL_OK)
   {
     Error_Handler();
   }
@@ -199,27 +319,67 @@ void SystemClock_Config(void)
 
 /* USER CODE BEGIN 4 */
 /**
-  * @brief  This function checks the configuration resistor and set up the proper adc channel
+  * @brief  This function checks the configuration resistor and selects the light sensor adc channels.
+  * 		With the CES sensor board the on-board sensor is the second light sensor instance,
+  * 		otherwise the other channel is read by the absolute input instance
   * @retval None
   */
 void checkSensorType(void)
 {
-	ADC_ChannelConfTypeDef sConfig;
-	sConfig.Rank = ADC_RANK_CHANNEL_NUMBER;
-	sConfig.SamplingTime = ADC_SAMPLETIME_239CYCLES_5;
-
 	if(readPin(SENSOR_CONFIG_Pin) == 0) // use CES sensor board
 	{
-		sConfig.Channel = ADC_CHANNEL_1;
+		sensor_index = ADC_RESULT_CH1;
+		absolute_index = ADC_RESULT_CH9;
+		dual_sensor = TRUE;
 	}
 	else	// Use on-board sensor
 	{
-		sConfig.Channel = ADC_CHANNEL_9;
+		sensor_index = ADC_RESULT_CH9;
+		absolute_index = ADC_RESULT_CH1;
+		dual_sensor = FALSE;
 	}
-	if (HAL_ADC_ConfigChannel(&hadc, &sConfig) != HAL_OK)
+	second_index = absolute_index;
+}
+
+/**
+  * @brief  This function moves the analog watchdog window of the light sensor to its hysteresis band,
+  * 		and the software window of the second light sensor to its own band.
+  * 		The sensors are polled every second while a band cannot be mapped to ADC counts
+  * @retval None
+  */
+void updateSensorWindow(void)
+{
+	uint16_t low, high;
+	uint8_t second = FALSE;
+	// The hysteresis bands are reset by commands
+	DALI_Dispatch_Lock();
+	uint8_t mapped = DALI_Get_adcWindow(LIGHT_SENSOR_INSTANCE, &low, &high);
+	if(dual_sensor == TRUE)
+		second = DALI_Get_adcWindow(SECOND_LIGHT_SENSOR_INSTANCE, &second_low, &second_high);
+	DALI_Dispatch_Unlock();
+	if(mapped == TRUE)
 	{
-		Error_Handler();
+		// The watchdog compares raw conversions, the band is in compensated counts
+		adc_compensate_window(&low, &high);
+		adc_watchdog_arm(low, high);
 	}
+	else
+		adc_watchdog_disarm();
+	if(dual_sensor == TRUE)
+	{
+		second_window = second;
+		if(second_window == FALSE)
+			mapped = FALSE;
+	}
+	if(mapped == TRUE)
+		soft_timer_stop(&adc_poll_timer);
+	else if(!soft_timer_running(&adc_poll_timer))
+		soft_timer_start(&adc_poll_timer, 1000, adcPollExpired); //1000 ms
+}
+
+void adcPollExpired(soft_timer_t *timer)
+{
+	adc_flag = 1;
 }
 
 /* USER CODE END 4 */
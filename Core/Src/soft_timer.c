@@ -0,0 +1,216 @@
+/*
+ * soft_timer.c
+ * This file implements the software timers of the application. The running timers are
+ * kept in a heap ordered by deadline and TIM14 channel 1 compares against the earliest one,
+ * so the core only wakes up when a timer expires instead of on every millisecond
+ */
+
+#include "soft_timer.h"
+#include "main.h"
+#include "tim.h"
+
+soft_timer_t *timerHeap[SOFT_TIMER_MAX];
+uint8_t timerCount = 0;
+volatile uint16_t soft_timer_high = 0;
+uint8_t soft_timer_started = 0;
+
+// Private functions
+uint8_t soft_timer_before(soft_timer_t const *a, soft_timer_t const *b);
+void soft_timer_place(soft_timer_t *timer, uint8_t position);
+void soft_timer_sift_up(uint8_t position);
+void soft_timer_sift_down(uint8_t position);
+void soft_timer_remove(soft_timer_t *timer);
+void soft_timer_arm(void);
+
+void soft_timer_init(void)
+{
+	__HAL_TIM_ENABLE_IT(&htim14, TIM_IT_CC1);
+	HAL_TIM_Base_Start_IT(&htim14);
+	soft_timer_started = 1;
+	// HAL_GetTick reads TIM14 from now on, nothing needs the 1 ms interrupt anymore
+	HAL_SuspendTick();
+}
+
+uint32_t soft_timer_now(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint16_t high;
+	uint16_t low;
+	__disable_irq();
+	high = soft_timer_high;
+	low = htim14.Instance->CNT;
+	// The counter may have wrapped while its interrupt is still pending
+	if(((htim14.Instance->SR & TIM_SR_UIF) != 0) && (low < 0x8000))
+	{
+		high++;
+	}
+	__set_PRIMASK(primask);
+	return ((uint32_t) high << 16) | low;
+}
+
+void soft_timer_start(soft_timer_t *timer, uint32_t ms, soft_timer_callback_t callback)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(timer->slot != 0)
+		soft_timer_remove(timer);
+	if(ms != 0)
+	{
+		// Every timer object holds at most one slot, running out of them is a sizing error
+		if(timerCount >= SOFT_TIMER_MAX)
+			Error_Handler();
+		timer->deadline = soft_timer_now() + ms;
+		timer->callback = callback;
+		soft_timer_place(timer, timerCount++);
+		soft_timer_sift_up(timer->slot - 1);
+	}
+	soft_timer_arm();
+	__set_PRIMASK(primask);
+}
+
+void soft_timer_stop(soft_timer_t *timer)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(timer->slot != 0)
+	{
+		soft_timer_remove(timer);
+		soft_timer_arm();
+	}
+	__set_PRIMASK(primask);
+}
+
+uint8_t soft_timer_running(soft_timer_t const *timer)
+{
+	return timer->slot != 0;
+}
+
+uint32_t soft_timer_next(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint32_t next = 0xFFFFFFFF;
+	__disable_irq();
+	if(timerCount > 0)
+	{
+		int32_t left = timerHeap[0]->deadline - soft_timer_now();
+		next = (left > 0) ? left : 0;
+	}
+	__set_PRIMASK(primask);
+	return next;
+}
+
+void soft_timer_skip(uint32_t ms)
+{
+	uint32_t now = soft_timer_now() + ms;
+	// A pending overflow is already counted in now
+	__HAL_TIM_CLEAR_FLAG(&htim14, TIM_FLAG_UPDATE);
+	soft_timer_high = now >> 16;
+	htim14.Instance->CNT = now & 0xFFFF;
+	soft_timer_arm();
+}
+
+void soft_timer_overflow(void)
+{
+	__disable_irq();
+	soft_timer_high++;
+	__HAL_TIM_CLEAR_FLAG(&htim14, TIM_FLAG_UPDATE);
+	__enable_irq();
+}
+
+void soft_timer_handler(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	while((timerCount > 0) && ((int32_t)(timerHeap[0]->deadline - soft_timer_now()) <= 0))
+	{
+		soft_timer_t *timer = timerHeap[0];
+		soft_timer_remove(timer);
+		// The callback may start timers again, including this one
+		if(timer->callback != NULL)
+		{
+			__set_PRIMASK(primask);
+			timer->callback(timer);
+			__disable_irq();
+		}
+	}
+	soft_timer_arm();
+	__set_PRIMASK(primask);
+}
+
+uint8_t soft_timer_before(soft_timer_t const *a, soft_timer_t const *b)
+{
+	// Deadlines are compared relative to each other, which keeps working across the wrap of the time
+	return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+void soft_timer_place(soft_timer_t *timer, uint8_t position)
+{
+	timerHeap[position] = timer;
+	timer->slot = position + 1;
+}
+
+void soft_timer_sift_up(uint8_t position)
+{
+	soft_timer_t *timer = timerHeap[position];
+	while(position > 0)
+	{
+		uint8_t parent = (position - 1) >> 1;
+		if(!soft_timer_before(timer, timerHeap[parent]))
+			break;
+		soft_timer_place(timerHeap[parent], position);
+		position = parent;
+	}
+	soft_timer_place(timer, position);
+}
+
+void soft_timer_sift_down(uint8_t position)
+{
+	soft_timer_t *timer = timerHeap[position];
+	for(;;)
+	{
+		uint8_t child = 2*position + 1;
+		if(child >= timerCount)
+			break;
+		if((child + 1 < timerCount) && soft_timer_before(timerHeap[child + 1], timerHeap[child]))
+			child++;
+		if(!soft_timer_before(timerHeap[child], timer))
+			break;
+		soft_timer_place(timerHeap[child], position);
+		position = child;
+	}
+	soft_timer_place(timer, position);
+}
+
+void soft_timer_remove(soft_timer_t *timer)
+{
+	// The last timer of the heap fills the hole and moves to where its deadline belongs
+	uint8_t position = timer->slot - 1;
+	timer->slot = 0;
+	timerCount--;
+	if(position == timerCount)
+		return;
+	soft_timer_t *last = timerHeap[timerCount];
+	soft_timer_place(last, position);
+	soft_timer_sift_up(position);
+	soft_timer_sift_down(last->slot - 1);
+}
+
+void soft_timer_arm(void)
+{
+	if(timerCount == 0)
+		return;
+	// Deadlines more than a counter period away match early, the handler finds nothing expired and compares again
+	uint32_t deadline = timerHeap[0]->deadline;
+	__HAL_TIM_SET_COMPARE(&htim14, TIM_CHANNEL_1, deadline & 0xFFFF);
+	// A deadline already reached would only match after the next wrap of the counter
+	if((int32_t)(deadline - soft_timer_now()) <= 0)
+		htim14.Instance->EGR = TIM_EGR_CC1G;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	// SysTick keeps the tick until the timers are started
+	if(soft_timer_started == 0)
+		return uwTick;
+	return soft_timer_now();
+}
@@ -25,6 +25,10 @@
 /* USER CODE BEGIN Includes */
 #include "dali.h"
 #include "gpio.h"
+#include "dali_input.h"
+#include "adc.h"
+#include "soft_timer.h"
+#include "low_power.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -47,10 +51,18 @@
 #ifdef CONTROLLER
 volatile uint8_t collisionDetectEdge = 0;
 #endif
+#ifdef DEBUG
+// DEBUG: longest run of the DALI RX edge and timer handlers in core cycles
+volatile uint16_t rxIsrCycles = 0;
+volatile uint16_t timerIsrCycles = 0;
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
+#ifdef DEBUG
+void isr_cycles(volatile uint16_t *longest, uint32_t start);
+#endif
 
 /* USER CODE END PFP */
 
@@ -60,6 +72,8 @@ volatile uint8_t collisionDetectEdge = 0;
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
+extern DMA_HandleTypeDef hdma_adc;
+extern ADC_HandleTypeDef hadc;
 extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim6;
 extern TIM_HandleTypeDef htim14;
@@ -117,7 +131,7 @@ void SVC_Handler(void)
 void PendSV_Handler(void)
 {
   /* USER CODE BEGIN PendSV_IRQn 0 */
-
+	DALI_Dispatch();
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
 
@@ -130,32 +144,7 @@ void PendSV_Handler(void)
 void SysTick_Handler(void)
 {
   /* USER CODE BEGIN SysTick_IRQn 0 */
-	if(report_time > 0)
-	{
-		report_time--;
-	}
-	if(dead_time > 0)
-	{
-		dead_time--;
-	}
-	if(id_time > 0)
-	{
-		id_time--;
-		if(id_time == 0)
-			writePin(LED_Pin, 1);
-	}
-	if(adc_time > 0)
-	{
-		adc_time--;
-		if(adc_time == 0)
-			adc_flag = 1;
-	}
-	if(powerNoti_time > 0)
-	{
-		powerNoti_time--;
-		if(powerNoti_time == 0)
-			powerNoti_flag = 1;
-	}
+	// Only runs until soft_timer_init takes the HAL tick over
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
@@ -170,6 +159,44 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32f0xx.s).                    */
 /******************************************************************************/
 
+/**
+  * @brief This function handles DMA1 channel 1 interrupt.
+  */
+void DMA1_Channel1_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Channel1_IRQn 0 */
+
+  /* USER CODE END DMA1_Channel1_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_adc);
+  /* USER CODE BEGIN DMA1_Channel1_IRQn 1 */
+
+  /* USER CODE END DMA1_Channel1_IRQn 1 */
+}
+
+/**
+  * @brief This function handles EXTI line 2 and 3 interrupts.
+  */
+void EXTI2_3_IRQHandler(void)
+{
+  /* USER CODE BEGIN EXTI2_3_IRQn 0 */
+	if(__HAL_GPIO_EXTI_GET_IT(BUTTON_Pin) != 0x00u)
+	{
+		__HAL_GPIO_EXTI_CLEAR_IT(BUTTON_Pin);
+		DALI_Input_ButtonIntHandler();
+	}
+	if(__HAL_GPIO_EXTI_GET_IT(PIR_Pin) != 0x00u)
+	{
+		__HAL_GPIO_EXTI_CLEAR_IT(PIR_Pin);
+		DALI_Input_OccupancyIntHandler();
+	}
+	return;
+  /* USER CODE END EXTI2_3_IRQn 0 */
+  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_2);
+  /* USER CODE BEGIN EXTI2_3_IRQn 1 */
+
+  /* USER CODE END EXTI2_3_IRQn 1 */
+}
+
 /**
   * @brief This function handles EXTI line 4 to 15 interrupts.
   */
@@ -179,7 +206,8 @@ void EXTI4_15_IRQHandler(void)
 	if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_10) != 0x00u)
 	{
 		__HAL_GPIO_EXTI_CLEAR_IT(GPIO_PIN_10);
-		DALIRxIntHandler();
+		// Only the timestamp is taken here, the edge is decoded at the TIM2 priority
+		DALIRxEdgeCapture();
 	}
 	return;
   /* USER CODE END EXTI4_15_IRQn 0 */
@@ -189,18 +217,51 @@ void EXTI4_15_IRQHandler(void)
   /* USER CODE END EXTI4_15_IRQn 1 */
 }
 
+/**
+  * @brief This function handles ADC and COMP interrupts (COMP interrupts through EXTI lines 21 and 22).
+  */
+void ADC1_COMP_IRQHandler(void)
+{
+  /* USER CODE BEGIN ADC1_COMP_IRQn 0 */
+
+  /* USER CODE END ADC1_COMP_IRQn 0 */
+  HAL_ADC_IRQHandler(&hadc);
+  /* USER CODE BEGIN ADC1_COMP_IRQn 1 */
+
+  /* USER CODE END ADC1_COMP_IRQn 1 */
+}
+
 /**
   * @brief This function handles TIM2 global interrupt.
   */
 void TIM2_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM2_IRQn 0 */
+	// Edges captured since the last run go first, as they did when both interrupts shared a priority
+	if(DALIRxEdgePending() != 0)
+	{
+#ifdef DEBUG
+		uint32_t start = SysTick->VAL;
+		DALIRxEdgeDecode();
+		isr_cycles(&rxIsrCycles, start);
+#else
+		DALIRxEdgeDecode();
+#endif
+		adc_bus_hold();
+	}
+	DALIServiceTxQueue();
 	if (__HAL_TIM_GET_FLAG(&htim2, TIM_FLAG_UPDATE) != RESET)
 	{
 		if (__HAL_TIM_GET_IT_SOURCE(&htim2, TIM_IT_UPDATE) != RESET)
 		{
 			__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+#ifdef DEBUG
+			uint32_t start = SysTick->VAL;
 			DALITimerIntHandler();
+			isr_cycles(&timerIsrCycles, start);
+#else
+			DALITimerIntHandler();
+#endif
 		}
 	}
 	return;
@@ -217,6 +278,14 @@ void TIM2_IRQHandler(void)
 void TIM6_DAC_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM6_DAC_IRQn 0 */
+	if (__HAL_TIM_GET_FLAG(&htim6, TIM_FLAG_UPDATE) != RESET)
+	{
+		if (__HAL_TIM_GET_IT_SOURCE(&htim6, TIM_IT_UPDATE) != RESET)
+		{
+			time_base_overflow();
+		}
+	}
+	return;
   /* USER CODE END TIM6_DAC_IRQn 0 */
   HAL_TIM_IRQHandler(&htim6);
   /* USER CODE BEGIN TIM6_DAC_IRQn 1 */
@@ -230,23 +299,17 @@ void TIM6_DAC_IRQHandler(void)
 void TIM14_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM14_IRQn 0 */
-	// 1 minutes interrupt
-	if(quiescent_time > 0)
+	// 1 ms counter of the software timers, the update extends it and CC1 compares against the next deadline
+	if(__HAL_TIM_GET_FLAG(&htim14, TIM_FLAG_UPDATE) != RESET)
 	{
-		quiescent_time--;
-		if(quiescent_time == 0)
-		{
-			quiescentMode = DISABLED;
-		}
+		soft_timer_overflow();
 	}
-	if(initialise_time > 0)
+	if(__HAL_TIM_GET_FLAG(&htim14, TIM_FLAG_CC1) != RESET)
 	{
-		initialise_time--;
-		if(initialise_time == 0)
-		{
-			initialisationState = DISABLED;
-		}
+		__HAL_TIM_CLEAR_FLAG(&htim14, TIM_FLAG_CC1);
+		soft_timer_handler();
 	}
+	return;
   /* USER CODE END TIM14_IRQn 0 */
   HAL_TIM_IRQHandler(&htim14);
   /* USER CODE BEGIN TIM14_IRQn 1 */
@@ -255,6 +318,27 @@ void TIM14_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+#ifdef DEBUG
+/**
+  * @brief Keeps the longest handler run. SysTick counts down at the core clock and keeps running
+  * 	   with its interrupt suspended, one wrap of its 1 ms reload is accounted for.
+  */
+void isr_cycles(volatile uint16_t *longest, uint32_t start)
+{
+	int32_t cycles = start - SysTick->VAL;
+	if(cycles < 0)
+		cycles += SysTick->LOAD + 1;
+	if(cycles > *longest)
+		*longest = cycles;
+}
+#endif
+/**
+  * @brief This function handles RTC interrupt through EXTI line 17, the alarm that ends STOP.
+  */
+void RTC_IRQHandler(void)
+{
+	low_power_alarm();
+}
 
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
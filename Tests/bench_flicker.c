@@ -0,0 +1,146 @@
+/*
+ * bench_flicker.c
+ * Host benchmark of the flicker analysis. dali_flicker.c is linked as it is with stubs for
+ * the scope capture, the software timers and the instance table. Each analysis step is timed
+ * with the time stamp counter and the dominant frequency is checked against the input
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+#include "dali_flicker.h"
+#include "dali_application.h"
+#include "adc.h"
+
+#define BENCH_DARK		20		// Dark level in 12-bit counts, calibrationOffset
+#define BENCH_RUNS		5		// Analyses per signal, the fastest is kept
+
+// Stubs of the firmware the analysis reads from
+uint16_t adc_scope_buffer[ADC_SCOPE_SAMPLES];
+volatile uint8_t adc_scope_state = ADC_SCOPE_IDLE;
+uint8_t memory_bank_191[dispatchLatency_addr + 2];
+uint8_t lock_byte[256];
+uint16_t reported;
+
+void soft_timer_start(soft_timer_t *timer, uint32_t ms, soft_timer_callback_t callback)
+{
+	(void)timer; (void)ms; (void)callback;
+}
+
+uint8_t soft_timer_running(soft_timer_t const *timer)
+{
+	(void)timer;
+	return 1;
+}
+
+void adc_scope_start(uint8_t result_index, uint8_t period)
+{
+	(void)result_index; (void)period;
+}
+
+void DALI_Dispatch_Lock(void)
+{
+}
+
+void DALI_Dispatch_Unlock(void)
+{
+}
+
+void DALI_Instance_SetValue(uint8_t instance, uint16_t value)
+{
+	(void)instance;
+	reported = value;
+}
+
+typedef struct
+{
+	uint64_t	statistics;		// Cycles of the statistics step
+	uint64_t	binMax;			// Slowest Goertzel bin step
+	uint64_t	total;			// Cycles of the whole analysis
+} bench_t;
+
+// Run one analysis of the capture in adc_scope_buffer, one step at a time like the main loop
+bench_t bench_analysis(void)
+{
+	bench_t b = {0, 0, 0};
+	adc_scope_state = ADC_SCOPE_DONE;
+	flicker.state = FLICKER_STATISTICS;
+	uint8_t busy = 1;
+	while(busy)
+	{
+		flicker_state_t state = flicker.state;
+		_mm_lfence();
+		uint64_t start = __rdtsc();
+		busy = DALI_Flicker_Update(0);
+		_mm_lfence();
+		uint64_t cycles = __rdtsc() - start;
+		b.total += cycles;
+		if(state == FLICKER_STATISTICS)
+			b.statistics = cycles;
+		else if(cycles > b.binMax)
+			b.binMax = cycles;
+	}
+	return b;
+}
+
+void bench_signal(double frequency, double depth, uint8_t square)
+{
+	// Light level of about half the ADC range, modulated by depth
+	for(uint16_t n = 0; n < ADC_SCOPE_SAMPLES; n++)
+	{
+		double phase = 2*M_PI*frequency*n/FLICKER_SAMPLE_RATE;
+		double wave = square ? ((sin(phase) >= 0) ? 1 : -1) : sin(phase);
+		adc_scope_buffer[n] = BENCH_DARK + (uint16_t)(1500*(1 + depth*wave));
+	}
+}
+
+int main(void)
+{
+	// calibrationOffset is read from memory bank 189 in flash, map the page at its address
+	uintptr_t page = MEMORY_BANK_189_ADDR & ~(uintptr_t)0xFFF;
+	if(mmap((void *)page, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void *)page)
+	{
+		printf("bench_flicker: cannot map memory bank 189\n");
+		return 1;
+	}
+	memset((void *)page, 0xFF, 0x1000);
+	calibrationOffset = BENCH_DARK;
+
+	static const double frequencies[] = {50, 100, 120, 300, 600, 990};
+	int failed = 0;
+	uint64_t statistics = ~0ULL, binMax = 0, total = 0;
+	printf("signal        Hz  found Hz  percent  index  statistics  slowest bin  analysis (cycles)\n");
+	for(uint8_t square = 0; square < 2; square++)
+	{
+		for(uint8_t f = 0; f < sizeof(frequencies)/sizeof(frequencies[0]); f++)
+		{
+			bench_signal(frequencies[f], 0.3, square);
+			bench_t best = {~0ULL, ~0ULL, ~0ULL};
+			for(uint8_t run = 0; run < BENCH_RUNS; run++)
+			{
+				bench_t b = bench_analysis();
+				if(b.total < best.total)
+					best = b;
+			}
+			printf("%-8s  %6.0f  %8u  %5u.%u  0.%03u  %10llu  %11llu  %8llu\n", square ? "square" : "sine", frequencies[f],
+					flicker.frequency, flicker.percent/10, flicker.percent%10, flicker.index,
+					(unsigned long long)best.statistics, (unsigned long long)best.binMax, (unsigned long long)best.total);
+			// One bin is FLICKER_SAMPLE_RATE/ADC_SCOPE_SAMPLES Hz wide
+			if(fabs(flicker.frequency - frequencies[f]) > (double)FLICKER_SAMPLE_RATE/ADC_SCOPE_SAMPLES)
+				failed = 1;
+			if(best.statistics < statistics)
+				statistics = best.statistics;
+			if(best.binMax > binMax)
+				binMax = best.binMax;
+			if(best.total > total)
+				total = best.total;
+		}
+	}
+	printf("%u samples, %u bins: statistics %llu, slowest bin %llu, slowest analysis %llu host cycles\n",
+			ADC_SCOPE_SAMPLES, FLICKER_BIN_MAX - FLICKER_BIN_MIN + 1,
+			(unsigned long long)statistics, (unsigned long long)binMax, (unsigned long long)total);
+	printf("bench_flicker: %s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
@@ -0,0 +1,138 @@
+/*
+ * host_sim.c
+ * Simulated millisecond clock and software timers for the host tests, with stubs of the
+ * application calls of dali_input.c and the value path of DALI_SendEvent around them
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include "host_sim.h"
+#include "dali_memory.h"
+#include "gpio.h"
+
+DALIInstances_t instances;
+uint32_t host_sim_now = 0;
+uint32_t host_sim_pending = 0;
+// Timers started so far, a stopped timer keeps its entry
+soft_timer_t *host_sim_timers[2*MAX_INSTANCES + 8];
+
+uint8_t readPin(uint16_t pin)
+{
+	// Button released, PIR without movement
+	return (pin == BUTTON_Pin) ? 1 : 0;
+}
+
+void soft_timer_start(soft_timer_t *timer, uint32_t ms, soft_timer_callback_t callback)
+{
+	if(ms == 0)
+	{
+		timer->slot = 0;
+		return;
+	}
+	timer->deadline = host_sim_now + ms;
+	timer->callback = callback;
+	timer->slot = 1;
+	for(uint8_t i = 0; i < sizeof(host_sim_timers)/sizeof(host_sim_timers[0]); i++)
+	{
+		if((host_sim_timers[i] == timer) || (host_sim_timers[i] == NULL))
+		{
+			host_sim_timers[i] = timer;
+			return;
+		}
+	}
+}
+
+void soft_timer_stop(soft_timer_t *timer)
+{
+	timer->slot = 0;
+}
+
+uint8_t soft_timer_running(soft_timer_t const *timer)
+{
+	return timer->slot != 0;
+}
+
+void DALI_Instance_ReportExpired(soft_timer_t *timer)
+{
+	host_sim_pending |= (1UL << (timer - instances.reportTimer));
+}
+
+void DALI_Instance_DeadtimeExpired(soft_timer_t *timer)
+{
+	host_sim_pending |= (1UL << (timer - instances.deadTimer));
+}
+
+void DALI_Instance_RestartTimers(uint8_t instance)
+{
+	soft_timer_start(&instances.reportTimer[instance], instances.tReport[instance]*1000UL, DALI_Instance_ReportExpired);
+	soft_timer_start(&instances.deadTimer[instance], instances.tDeadtime[instance]*50UL, DALI_Instance_DeadtimeExpired);
+}
+
+void DALI_Instance_SetValue(uint8_t instance, uint16_t value)
+{
+	if(instances.inputValue[instance] != value)
+	{
+		instances.inputValue[instance] = value;
+		host_sim_pending |= (1UL << instance);
+	}
+}
+
+void DALI_Instance_RaiseEvent(uint8_t instance, uint16_t eventInfo, uint32_t filter)
+{
+	(void)instance; (void)eventInfo; (void)filter;
+}
+
+void host_sim_tick(void)
+{
+	host_sim_now++;
+	for(uint8_t i = 0; i < sizeof(host_sim_timers)/sizeof(host_sim_timers[0]); i++)
+	{
+		soft_timer_t *timer = host_sim_timers[i];
+		if((timer != NULL) && (timer->slot != 0) && ((int32_t)(host_sim_now - timer->deadline) >= 0))
+		{
+			timer->slot = 0;
+			if(timer->callback != NULL)
+				timer->callback(timer);
+		}
+	}
+}
+
+void host_sim_instance(uint8_t instance, uint8_t instanceType)
+{
+	instances.instanceType[instance] = instanceType;
+	instances.tReport[instance] = 30;
+	instances.tDeadtime[instance] = 30;
+	instances.hysteresisMin[instance] = 10;
+	instances.hysteresis[instance] = 5;
+	instances.hysteresisMul[instance] = HYSTERESIS_MUL(instances.hysteresis[instance]);
+}
+
+enum host_sim_result host_sim_value_event(uint8_t instance)
+{
+	if((host_sim_pending & (1UL << instance)) == 0)
+		return HOST_SIM_NONE;
+	host_sim_pending &= ~(1UL << instance);
+	// The end of the dead time marks the instance again
+	if(soft_timer_running(&instances.deadTimer[instance]))
+		return HOST_SIM_NONE;
+	if(DALI_Input_Hysteresis(instance, instances.inputValue[instance]))
+	{
+		DALI_Instance_RestartTimers(instance);
+		return HOST_SIM_EVENT;
+	}
+	if(!soft_timer_running(&instances.reportTimer[instance]) && (instances.tReport[instance] != 0))
+	{
+		DALI_Instance_RestartTimers(instance);
+		return HOST_SIM_REPORT;
+	}
+	return HOST_SIM_NONE;
+}
+
+uint8_t host_sim_map_bank_189(void)
+{
+	uintptr_t page = MEMORY_BANK_189_ADDR & ~(uintptr_t)0xFFF;
+	if(mmap((void *)page, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void *)page)
+		return 0;
+	memset((void *)page, 0xFF, 0x1000);
+	return 1;
+}
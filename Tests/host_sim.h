@@ -0,0 +1,39 @@
+/*
+ * host_sim.h
+ * Simulated millisecond clock and software timers for the host tests, with stubs of the
+ * application calls of dali_input.c and the value path of DALI_SendEvent around them
+ */
+
+#ifndef TESTS_HOST_SIM_H_
+#define TESTS_HOST_SIM_H_
+
+#include "dali_input.h"
+
+// Bus time of one event: 24-bit frame plus the nominal priority 4 settling time, us
+#define HOST_SIM_FRAME_US		(50*416667UL/1000 + 18525)
+
+// What the value path did with a pending instance
+enum host_sim_result
+{
+	HOST_SIM_NONE,
+	HOST_SIM_EVENT,			// The value left the hysteresis band
+	HOST_SIM_REPORT			// tReport heartbeat
+};
+
+// Milliseconds since the start and the instances marked for evaluation
+extern uint32_t host_sim_now;
+extern uint32_t host_sim_pending;
+
+// Move the clock on by one ms and call the callbacks of the expired timers, like the TIM14 ISR
+void host_sim_tick(void);
+
+// Set up an instance with the defaults of DALI_AppInit
+void host_sim_instance(uint8_t instance, uint8_t instanceType);
+
+// Evaluate a pending instance as DALI_SendEvent does for value reporting instance types
+enum host_sim_result host_sim_value_event(uint8_t instance);
+
+// Map the flash page of memory bank 189 at its address and fill it with erased bytes, returns 0 on failure
+uint8_t host_sim_map_bank_189(void);
+
+#endif /* TESTS_HOST_SIM_H_ */
@@ -0,0 +1,119 @@
+/*
+ * test_absolute_sweep.c
+ * Host sweep of the absolute input. dali_input.c is linked as it is with a simulated
+ * millisecond clock for the software timers. A full-scale position sweep is sampled at the
+ * rate the driver asks for and its values go through the hysteresis and dead time of the
+ * event path. The samples show the CPU load, the events and their frames the bus load
+ */
+
+#include <stdio.h>
+#include "host_sim.h"
+
+// Oversampled 12-bit full scale and the noise added to every sample, in 16-bit counts
+#define SWEEP_FULL_SCALE	(16*4095)
+#define SWEEP_NOISE			32
+// The position rests this long before and after each sweep, ms
+#define SWEEP_REST			20000
+
+extern DALIAbsoluteInput_t absoluteInput;
+
+typedef struct
+{
+	uint32_t	samples;
+	uint32_t	events;			// Value left the hysteresis band
+	uint32_t	reports;		// tReport heartbeats
+	uint16_t	reported;		// Last value sent
+} sweep_t;
+
+// One ms of the firmware: the timers, the sampling of the main loop and the event evaluation
+void sweep_tick(sweep_t *s, uint16_t position)
+{
+	host_sim_tick();
+	if(absolute_flag == 1)
+	{
+		absolute_flag = 0;
+		s->samples++;
+		// LCG noise, the same sequence on every run
+		static uint32_t seed = 1;
+		seed = seed*1664525 + 1013904223;
+		int32_t sample = position + (int32_t)(seed >> 16) % (SWEEP_NOISE + 1) - SWEEP_NOISE/2;
+		if(sample < 0)
+			sample = 0;
+		else if(sample > SWEEP_FULL_SCALE)
+			sample = SWEEP_FULL_SCALE;
+		DALI_Input_AbsoluteSample(sample);
+	}
+	switch(host_sim_value_event(ABSOLUTE_INPUT_INSTANCE))
+	{
+	case HOST_SIM_EVENT:
+		s->events++;
+		s->reported = instances.inputValue[ABSOLUTE_INPUT_INSTANCE];
+		break;
+	case HOST_SIM_REPORT:
+		s->reports++;
+		s->reported = instances.inputValue[ABSOLUTE_INPUT_INSTANCE];
+		break;
+	default:
+		break;
+	}
+}
+
+// Sweep from one end to the other in duration ms and rest there, returns non-zero on failure
+int sweep_run(uint32_t duration, uint16_t from, uint16_t to)
+{
+	sweep_t s = {0, 0, 0, 0};
+	for(uint32_t t = 0; t < duration; t++)
+	{
+		sweep_tick(&s, from + ((int32_t)to - from)*(int32_t)t/(int32_t)duration);
+	}
+	sweep_t moving = s;
+	for(uint32_t t = 0; t < SWEEP_REST; t++)
+	{
+		sweep_tick(&s, to);
+	}
+	uint8_t i = ABSOLUTE_INPUT_INSTANCE;
+	uint32_t fixed = (duration + SWEEP_REST)/ABSOLUTE_T_FAST;
+	uint32_t frames = s.events + s.reports;
+	printf("%6u ms  %5u -> %5u  %6u  %7u  %5u  %6u  %7u  %6.2f %%\n", duration, from, to,
+			moving.samples, s.samples, fixed, s.events, s.reports,
+			100.0*frames*HOST_SIM_FRAME_US/((duration + SWEEP_REST)*1000.0));
+	// The rest ends with the slow sampling period, the last value inside the band unless the dead
+	// time holds it back, and the end position reported within the hysteresis and the noise
+	uint32_t band = instances.hysteresis[i]*to/100;
+	if(band < instances.hysteresisMin[i])
+		band = instances.hysteresisMin[i];
+	uint32_t error = (s.reported > to) ? (s.reported - to) : (to - s.reported);
+	uint8_t outside = (instances.inputValue[i] > instances.hysteresisBandHigh[i]) || (instances.inputValue[i] < instances.hysteresisBandLow[i]);
+	if((absoluteInput.period != ABSOLUTE_T_IDLE) || (outside && !soft_timer_running(&instances.deadTimer[i]))
+			|| (error > band + SWEEP_NOISE/2))
+	{
+		printf("sweep: end position %u reported as %u, value %u, band %u to %u, period %u ms\n", to, s.reported,
+				instances.inputValue[i], instances.hysteresisBandLow[i], instances.hysteresisBandHigh[i], absoluteInput.period);
+		return 1;
+	}
+	// Resting, the driver samples once per ABSOLUTE_T_IDLE after it has settled at ABSOLUTE_T_FAST
+	if(s.samples - moving.samples > SWEEP_REST/ABSOLUTE_T_IDLE + ABSOLUTE_SETTLE_COUNT + 2)
+	{
+		printf("sweep: %u samples while resting\n", s.samples - moving.samples);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	host_sim_instance(ABSOLUTE_INPUT_INSTANCE, ABSOLUTE_INPUT);
+	DALI_Input_Init();
+
+	static const uint32_t durations[] = {200, 1000, 5000, 20000};
+	int failed = 0;
+	// Samples while moving, in all and at a fixed ABSOLUTE_T_FAST period for comparison
+	printf("   sweep  position         moving  samples  fixed  events  reports  bus load\n");
+	for(uint8_t d = 0; d < sizeof(durations)/sizeof(durations[0]); d++)
+	{
+		failed |= sweep_run(durations[d], 0, SWEEP_FULL_SCALE);
+		failed |= sweep_run(durations[d], SWEEP_FULL_SCALE, 0);
+	}
+	printf("test_absolute_sweep: %s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
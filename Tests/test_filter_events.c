@@ -0,0 +1,154 @@
+/*
+ * test_filter_events.c
+ * Host test of the event rate of the light sensor filter stage. Synthetic traces of sensor
+ * noise, mains flicker and spikes are converted at 1 kHz and summed 16 at a time as the ADC
+ * does, then go through DALI_Filter_Update and the hysteresis and dead time of the event path.
+ * Every result is evaluated, which the firmware only does when the analog watchdog or the
+ * polling timer asks for it, so the rates are an upper bound. Each filter type is compared
+ * with FILTER_NONE and must still report a step of the light level
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "host_sim.h"
+#include "dali_filter.h"
+#include "dali_memory.h"
+
+// Light level before and after the step, in 12-bit counts, and the time of the step in ms
+#define TRACE_LEVEL			1200
+#define TRACE_STEP			1680
+#define TRACE_STEP_TIME		(4*60*1000UL)
+#define TRACE_LENGTH		(5*60*1000UL)
+// Conversions summed into one result
+#define TRACE_OVERSAMPLING	16
+
+typedef enum
+{
+	TRACE_NOISE,			// Sensor noise of +-20 % per conversion
+	TRACE_FLICKER,			// 30 % mains flicker at 100 Hz and +-5 % noise
+	TRACE_SPIKES,			// +-5 % noise and a 3 ms reflection of three times the level every 1.5 s
+	TRACE_TYPES
+} trace_t;
+
+static const char *traceName[TRACE_TYPES] = {"noise", "flicker", "spikes"};
+
+typedef struct
+{
+	const char	*name;
+	uint8_t		type;
+	uint8_t		length;
+	uint8_t		shift;
+} filter_config_t;
+
+static const filter_config_t filters[] =
+{
+	{"none", FILTER_NONE, 1, 0},
+	{"moving average 8", FILTER_MOVING_AVERAGE, 8, 0},
+	{"iir 1/8", FILTER_IIR, 1, 3},
+	{"median 5", FILTER_MEDIAN, 5, 0},
+	{"median 5, iir 1/8", FILTER_MEDIAN_IIR, 5, 3}
+};
+
+// One 12-bit conversion of a trace at time t in ms
+uint16_t trace_sample(trace_t trace, uint32_t t, uint32_t *seed)
+{
+	double level = (t < TRACE_STEP_TIME) ? TRACE_LEVEL : TRACE_STEP;
+	*seed = *seed*1664525 + 1013904223;
+	double noise = ((double)(*seed >> 8)/(1 << 24))*2 - 1;
+	double x;
+	switch(trace)
+	{
+	case TRACE_NOISE:
+		x = level*(1 + 0.2*noise);
+		break;
+	case TRACE_FLICKER:
+		// The mains frequency is slightly off the ADC clock, the phase drifts
+		x = level*(1 + 0.3*sin(2*M_PI*100.3*t/1000) + 0.05*noise);
+		break;
+	default:
+		x = level*(1 + 0.05*noise);
+		if((t % 1500) < 3)
+			x *= 3;
+		break;
+	}
+	return (x > 4095) ? 4095 : (uint16_t)x;
+}
+
+// MSB-aligned instance value of an oversampled result, DALI_Set_inputValue with the default calibration
+uint16_t trace_value(uint32_t adcVal)
+{
+	uint32_t value = 1000*adcVal/(16*16*255);
+	if(value > 0x3FF)
+		value = 0x3FF;
+	return (value << 6) | (value >> 4);
+}
+
+// Run a trace through a filter, returns the events before the step. The dead time of the
+// AppInit defaults, 1.5 s, limits them to 40 per minute
+uint32_t trace_run(trace_t trace, filter_config_t const *config, uint16_t *reported)
+{
+	*(uint8_t *)(MEMORY_BANK_189_ADDR + filterType_addr) = config->type;
+	*(uint8_t *)(MEMORY_BANK_189_ADDR + filterLength_addr) = config->length;
+	*(uint8_t *)(MEMORY_BANK_189_ADDR + filterShift_addr) = config->shift;
+	DALIFilter_t filter;
+	DALI_Filter_Configure(&filter);
+
+	uint8_t i = LIGHT_SENSOR_INSTANCE;
+	instances.hysteresisBandHigh[i] = 0;
+	instances.hysteresisBandLow[i] = 0;
+	soft_timer_stop(&instances.reportTimer[i]);
+	soft_timer_stop(&instances.deadTimer[i]);
+	uint32_t seed = 1, sum = 0, events = 0;
+	for(uint32_t t = 0; t < TRACE_LENGTH; t++)
+	{
+		host_sim_tick();
+		sum += trace_sample(trace, t, &seed);
+		if((t % TRACE_OVERSAMPLING) == TRACE_OVERSAMPLING - 1)
+		{
+			DALI_Instance_SetValue(i, trace_value(DALI_Filter_Update(&filter, sum)));
+			sum = 0;
+		}
+		enum host_sim_result result = host_sim_value_event(i);
+		if(result != HOST_SIM_NONE)
+		{
+			*reported = instances.inputValue[i] >> 6;
+			// tReport heartbeats are the same for every filter
+			if((result == HOST_SIM_EVENT) && (t < TRACE_STEP_TIME))
+				events++;
+		}
+	}
+	return events;
+}
+
+int main(void)
+{
+	if(host_sim_map_bank_189() == 0)
+	{
+		printf("test_filter_events: cannot map memory bank 189\n");
+		return 1;
+	}
+	host_sim_instance(LIGHT_SENSOR_INSTANCE, LIGHT_SENSOR);
+
+	int failed = 0;
+	uint16_t stepValue = 1000*TRACE_OVERSAMPLING*TRACE_STEP/(16*16*255);
+	printf("trace     filter                events/min  of none  step reported\n");
+	for(trace_t trace = 0; trace < TRACE_TYPES; trace++)
+	{
+		uint32_t none = 0;
+		for(uint8_t f = 0; f < sizeof(filters)/sizeof(filters[0]); f++)
+		{
+			uint16_t reported = 0;
+			uint32_t events = trace_run(trace, &filters[f], &reported);
+			if(f == 0)
+				none = events;
+			double perMinute = events/(TRACE_STEP_TIME/60000.0);
+			printf("%-8s  %-20s  %10.1f  %6.0f %%  %4u of %4u\n", traceName[trace], filters[f].name, perMinute,
+					none ? 100.0*events/none : 100.0, reported, stepValue);
+			// A filter may not add events, and the step must come through within the hysteresis
+			if((events > none) || (reported < stepValue - stepValue*instances.hysteresis[LIGHT_SENSOR_INSTANCE]/100))
+				failed = 1;
+		}
+	}
+	printf("test_filter_events: %s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
@@ -0,0 +1,66 @@
+/*
+ * test_fixed_ratio.c
+ * Host test of the division-free light sensor conversion and hysteresis band. Both are
+ * compared with the divisions they replace over every input they can be given
+ */
+
+#include <stdio.h>
+#include "fixed_ratio.h"
+#include "dali_application.h"
+
+// 16 oversampled 12-bit conversions
+#define ADC_MAX		(16*4095)
+
+int test_conversion(void)
+{
+	// d = 16*(16*calibrationScale - calibrationOffset), both bytes, see DALI_Update_Conversion
+	for(uint32_t span = 1; span <= 16*255; span++)
+	{
+		uint32_t divisor = 16*span;
+		uint32_t mul = fixed_ratio_mul(1000, divisor, CONVERSION_SHIFT);
+		uint32_t limit = fixed_ratio_limit(1000, divisor, 0x3FF + 1);
+		for(uint32_t adcVal = 0; adcVal <= ADC_MAX; adcVal++)
+		{
+			uint32_t expected = 1000*adcVal/divisor;
+			if(expected > 0x3FF)
+				expected = 0x3FF;
+			uint32_t value = (adcVal >= limit) ? 0x3FF : fixed_ratio(adcVal, 1000, divisor, mul, CONVERSION_SHIFT);
+			if(value > 0x3FF)
+				value = 0x3FF;
+			// The multiply must not wrap, an exact result could otherwise hide it
+			if((value != expected) || ((adcVal < limit) && ((uint64_t)adcVal*mul > 0xFFFFFFFF)))
+			{
+				printf("conversion: d %u adcVal %u gives %u instead of %u\n", divisor, adcVal, value, expected);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int test_hysteresis(void)
+{
+	// SET HYSTERESIS accepts 0 to 25 %, inputValue is a 16-bit MSB-aligned value
+	for(uint32_t hysteresis = 0; hysteresis <= 25; hysteresis++)
+	{
+		uint32_t mul = HYSTERESIS_MUL(hysteresis);
+		for(uint32_t inputValue = 0; inputValue <= 0xFFFF; inputValue++)
+		{
+			uint32_t expected = hysteresis*inputValue/100;
+			uint32_t band = fixed_ratio(inputValue, hysteresis, 100, mul, HYSTERESIS_SHIFT);
+			if((band != expected) || ((uint64_t)inputValue*mul > 0xFFFFFFFF))
+			{
+				printf("hysteresis: %u %% of %u gives %u instead of %u\n", hysteresis, inputValue, band, expected);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	int failed = test_conversion() + test_hysteresis();
+	printf("test_fixed_ratio: %s\n", failed ? "FAILED" : "passed");
+	return failed;
+}